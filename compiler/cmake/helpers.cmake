@@ -12,8 +12,44 @@ macro(axon_compiler_generate name header)
   if(NOT IS_ABSOLUTE "${header}")
     set(header "${CMAKE_CURRENT_BINARY_DIR}/${header}")
   endif()
-  add_custom_command(OUTPUT "${header}"
-    COMMAND $<TARGET_FILE:axon::compiler::${name}> -o "${header}"
+  # The compiler leaves the header untouched when the generated code does not change, so the stamp file records when
+  # it last ran instead. That way, rebuilding the compiler does not recompile everything that includes the header.
+  # Targets that include the header depend on axon_generate_${name}.
+  add_custom_command(OUTPUT "${header}.stamp"
+    BYPRODUCTS "${header}"
+    COMMAND $<TARGET_FILE:axon::compiler::${name}> -o "${header}" ${ARGN}
+    COMMAND ${CMAKE_COMMAND} -E touch "${header}.stamp"
     DEPENDS axon::compiler::${name}
   )
+  add_custom_target(axon_generate_${name} DEPENDS "${header}.stamp")
 endmacro()
+
+# Like axon_compiler_generate, but the functions are defined in the given number of C source files instead of in the
+# header, and compiled into a static library named axon_${name}. Targets that link against it can include the header
+# and are built after it is generated. Large functions are split across the source files, so that they compile in
+# parallel, and changing the network does not recompile the targets that include the header.
+function(axon_compiler_generate_library name header num_sources)
+  if(NOT IS_ABSOLUTE "${header}")
+    set(header "${CMAKE_CURRENT_BINARY_DIR}/${header}")
+  endif()
+  get_filename_component(dir "${header}" DIRECTORY)
+  get_filename_component(stem "${header}" NAME_WE)
+  set(sources)
+  math(EXPR last "${num_sources} - 1")
+  foreach(i RANGE ${last})
+    list(APPEND sources "${dir}/${stem}_${i}.c")
+  endforeach()
+  add_custom_command(OUTPUT "${header}.stamp"
+    BYPRODUCTS "${header}" ${sources}
+    COMMAND $<TARGET_FILE:axon::compiler::${name}> -o "${header}" --source-files ${num_sources} ${ARGN}
+    COMMAND ${CMAKE_COMMAND} -E touch "${header}.stamp"
+    DEPENDS axon::compiler::${name}
+  )
+  add_custom_target(axon_generate_${name} DEPENDS "${header}.stamp")
+  add_library(axon_${name} STATIC ${sources} "${header}")
+  add_dependencies(axon_${name} axon_generate_${name})
+  target_include_directories(axon_${name} PUBLIC "${dir}")
+  if(UNIX)
+    target_link_libraries(axon_${name} PUBLIC m)
+  endif()
+endfunction()
@@ -5,8 +5,11 @@
 #include <axon/module_builder.hpp>
 #endif
 
+#include <axon/value.hpp>
+
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace axon {
 
@@ -27,6 +30,67 @@ public:
     std::string parametersPath{ "params.bin" };
 
     std::string exporter{ "c" };
+
+    /**
+     * @brief The number of segments for gradient checkpointing, or zero to keep every forward value live.
+     *
+     * @details More segments means fewer live values in the backward pass, at the cost of recomputing most of the
+     *          forward pass once. See ModuleBuilder::buildWithGrad. Boundaries that are marked with
+     *          Compiler::markCheckpoint take precedence over this.
+     * */
+    uint32_t checkpointSegments{ 0 };
+
+    /**
+     * @brief The number of C source files to define the generated functions in, or zero to define them in the header.
+     *
+     * @details The source files are named after the header, with an index appended, and can be compiled in parallel.
+     *          The header then only declares the functions, so including it is cheap.
+     * */
+    uint32_t sourceFiles{ 0 };
+
+    /**
+     * @brief The largest number of statements in a generated function, when using source files.
+     *
+     * @details Longer functions are split into parts that go to different source files. The parts are cut where the
+     *          fewest values are live, since those are passed from one part to the next through memory.
+     * */
+    uint32_t chunkSize{ 4096 };
+
+    /**
+     * @brief Whether the C exporter rewrites the dot products of matrix products as loops.
+     *
+     * @details This makes the generated code much smaller and quicker to compile, but for small networks the
+     *          unrolled code may be faster.
+     * */
+    bool reroll{ true };
+
+    /**
+     * @brief Whether the C exporter moves repeated subgraphs, such as the layers of a network, to functions that are
+     *        called for each occurrence.
+     *
+     * @details Like rerolling, this trades some speed for much smaller code.
+     * */
+    bool outline{ true };
+  };
+
+  /**
+   * @brief A group of inputs that is evaluated in its own step, when using staged evaluation.
+   * */
+  struct EvalStage final
+  {
+    std::string name;
+
+    std::vector<Value> inputs;
+  };
+
+  /**
+   * @brief A named subset of the outputs, which gets its own eval function.
+   * */
+  struct OutputGroup final
+  {
+    std::string name;
+
+    std::vector<Value> outputs;
   };
 
   [[nodiscard]] static auto create(const Options& options) -> std::unique_ptr<Compiler>;
@@ -35,11 +99,132 @@ public:
 
   virtual void buildEvalModule(const std::vector<Value>& outputs) = 0;
 
+  /**
+   * @brief Builds the eval module from named groups of outputs.
+   *
+   * @details The outputs of the eval module are the outputs of all groups, in order. In addition to the regular eval
+   *          function, each group gets an eval function that only computes the outputs of that group.
+   * */
+  virtual void buildEvalModule(const std::vector<OutputGroup>& groups) = 0;
+
   virtual void buildGradModule(const Value& loss) = 0;
 
+  /**
+   * @brief Builds the grad module, with extra values that the training step can output alongside the loss.
+   *
+   * @param auxOutputs Forward values, usually the eval outputs, that are computed in the same pass as the gradient.
+   * */
+  virtual void buildGradModule(const Value& loss, const std::vector<Value>& auxOutputs) = 0;
+
+  /**
+   * @brief Builds the grad module for several losses, such as a reconstruction term and a regularizer, which share
+   *        one forward pass.
+   *
+   * @details The generated code gets an entry point that takes one weight per loss at run time and computes the
+   *          weighted sum of the gradients in a single reverse sweep. The regular entry points use a weight of one
+   *          for every loss. The gradient of a single loss is obtained by setting the other weights to zero.
+   *
+   * @param auxOutputs Forward values that are output after the losses, see the single loss overload.
+   * */
+  virtual void buildGradModule(const std::vector<Value>& losses, const std::vector<Value>& auxOutputs) = 0;
+
+  virtual void buildGradModule(const std::vector<Value>& losses) = 0;
+
+  /**
+   * @brief Builds the backward module, which backpropagates from the outputs of the eval module to the parameters.
+   *
+   * @details This allows the forward pass to run separately from the backward pass, which reuses the values saved by
+   *          the forward pass instead of computing them again. The eval module has to be built first.
+   * */
+  virtual void buildBackwardModule() = 0;
+
+  /**
+   * @brief Builds a module that computes the Jacobian-vector product of the given outputs, using forward-mode
+   *        differentiation.
+   *
+   * @details This costs about one extra forward pass, regardless of the number of outputs. That makes it cheaper than
+   *          the reverse mode when there are few inputs and many outputs.
+   *
+   * @param outputs The values to differentiate.
+   *
+   * @param tangentInputs The inputs to differentiate with respect to. Their tangents are passed to the generated
+   *                      function in this order.
+   * */
+  virtual void buildJvpModule(const std::vector<Value>& outputs, const std::vector<Value>& tangentInputs) = 0;
+
+  /**
+   * @brief Builds a module that computes the product of the Hessian of the loss (with respect to the parameters) and
+   *        a vector, for second-order optimizers such as Newton-CG.
+   *
+   * @details The cost is a small constant multiple of the cost of the gradient.
+   * */
+  virtual void buildHvpModule(const Value& loss) = 0;
+
+  /**
+   * @brief Freezes a named group of parameters, for fine-tuning the rest of the network.
+   *
+   * @details The group is the parameter with the given name, or the parameter array that was created with it, see
+   *          ModuleBuilder::freeze. This has to be called before the grad and backward modules are built. The
+   *          gradients of frozen parameters are zero, and the generated code also gets an entry point that only
+   *          writes the gradients of the trainable parameters. Parameters can also be frozen when they are created,
+   *          see axon::param.
+   * */
+  virtual void freezeParameters(const std::string& name) = 0;
+
+  /**
+   * @brief Marks a boundary for gradient checkpointing, between the values that were created so far and the ones that
+   *        are created afterwards.
+   *
+   * @details The forward pass is then split at the marked boundaries, rather than into Options::checkpointSegments
+   *          segments of the same size, which lets the boundaries follow the structure of the network (such as the
+   *          ends of its layers). Marking a boundary enables checkpointing. This has to be called before the grad
+   *          module is built.
+   * */
+  virtual void markCheckpoint() = 0;
+
+  /**
+   * @brief Declares a stage for staged evaluation of the eval module.
+   *
+   * @details Stages are evaluated in the order they are declared, and together they have to cover every input of the
+   *          eval module exactly once. Each stage computes everything that only depends on its own inputs and the
+   *          inputs of the earlier stages, and passes the values needed later on through a stage buffer. For example,
+   *          when evaluating a network on a grid, declaring the row coordinate before the column coordinate means
+   *          that everything which only depends on the row is computed once per row instead of once per pixel.
+   *
+   * @param name The name of the stage, which becomes part of the generated function name.
+   *
+   * @param inputs The inputs of this stage, in the order that the generated function expects them.
+   * */
+  virtual void addEvalStage(const std::string& name, const std::vector<Value>& inputs) = 0;
+
   [[nodiscard]] virtual auto getEvalModule() const -> const Module* = 0;
 
   [[nodiscard]] virtual auto getGradModule() const -> const Module* = 0;
+
+  [[nodiscard]] virtual auto getBackwardModule() const -> const Module* = 0;
+
+  [[nodiscard]] virtual auto getJvpModule() const -> const Module* = 0;
+
+  [[nodiscard]] virtual auto getHvpModule() const -> const Module* = 0;
+
+  /**
+   * @brief The number of inputs that have tangents in the JVP module.
+   * */
+  [[nodiscard]] virtual auto getJvpTangents() const -> uint32_t = 0;
+
+  /**
+   * @brief The number of losses of the grad module. With more than one, the grad module has one weight input per loss.
+   * */
+  [[nodiscard]] virtual auto getGradLosses() const -> uint32_t = 0;
+
+  /**
+   * @brief The number of boundaries that were marked with markCheckpoint.
+   * */
+  [[nodiscard]] virtual auto getCheckpointMarks() const -> uint32_t = 0;
+
+  [[nodiscard]] virtual auto getEvalStages() const -> const std::vector<EvalStage>& = 0;
+
+  [[nodiscard]] virtual auto getOutputGroups() const -> const std::vector<OutputGroup>& = 0;
 };
 
 } // namespace axon
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <axon/compiler.hpp>
+
 #include <filesystem>
 #include <memory>
 #include <vector>
@@ -17,9 +19,14 @@ public:
 
   virtual ~Exporter();
 
-  virtual void exportFull(const Module& evalModule,
-                          const Module& gradModule,
-                          const std::filesystem::path& outputPath) = 0;
+  /**
+   * @brief Exports the code for both inference and training.
+   *
+   * @param compiler The compiler that the modules were built with. It has at least an eval module and a grad module.
+   *
+   * @param options The compiler options, which include the output file and the default path of the parameter file.
+   * */
+  virtual void exportFull(const Compiler& compiler, const Compiler::Options& options) = 0;
 
   virtual void exportLean(const Module& evalModule,
                           const std::vector<float>& parameters,
@@ -20,20 +20,27 @@ public:
 class InputExpr final : public Expr
 {
 public:
-  explicit InputExpr(uint32_t index);
+  explicit InputExpr(uint32_t index, const std::string_view& group = "");
 
   void accept(ExprVisitor& visitor) const override;
 
   [[nodiscard]] auto index() const -> uint32_t { return m_index; }
 
+  /**
+   * @brief The name of the input group that this input belongs to, or an empty string if it has none.
+   * */
+  [[nodiscard]] auto group() const -> std::string_view;
+
 private:
   uint32_t m_index;
+
+  std::string m_group;
 };
 
 class ParamExpr final : public Expr
 {
 public:
-  explicit ParamExpr(uint32_t index, const std::string_view& name = "");
+  explicit ParamExpr(uint32_t index, const std::string_view& name = "", bool frozen = false);
 
   void accept(ExprVisitor& visitor) const override;
 
@@ -41,10 +48,17 @@ public:
 
   [[nodiscard]] auto name() const -> std::string_view;
 
+  /**
+   * @brief Whether the parameter is excluded from training, in which case no gradient is computed for it.
+   * */
+  [[nodiscard]] auto frozen() const -> bool { return m_frozen; }
+
 private:
   uint32_t m_index;
 
   std::string m_name;
+
+  bool m_frozen{ false };
 };
 
 class ConstExpr final : public Expr
@@ -145,6 +159,21 @@ public:
   void accept(ExprVisitor& visitor) const override;
 };
 
+/**
+ * @brief Evaluates to its operand.
+ *
+ * @details This is used by gradient checkpointing, when a segment of the forward pass is recomputed from a saved
+ *          value. It keeps the C compiler from merging the recomputed values with the original ones, which would
+ *          keep the original values alive until the backward pass and defeat the purpose of recomputing them.
+ * */
+class CheckpointExpr final : public UnaryExpr
+{
+public:
+  using UnaryExpr::UnaryExpr;
+
+  void accept(ExprVisitor& visitor) const override;
+};
+
 class BinaryExpr : public Expr
 {
 public:
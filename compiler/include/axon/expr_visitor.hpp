@@ -11,6 +11,7 @@ class SqrtExpr;
 class ExpExpr;
 class SinExpr;
 class CosExpr;
+class CheckpointExpr;
 class ReLUExpr;
 class SigmoidExpr;
 class HeavisideExpr;
@@ -48,6 +49,8 @@ public:
 
   virtual void visit(const CosExpr&) = 0;
 
+  virtual void visit(const CheckpointExpr&) = 0;
+
   virtual void visit(const AddExpr&) = 0;
 
   virtual void visit(const SubExpr&) = 0;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <filesystem>
 #include <memory>
 
 #include <stdint.h>
@@ -30,4 +31,30 @@ public:
   [[nodiscard]] virtual auto numOutputs() const -> uint32_t = 0;
 };
 
+/**
+ * @brief Computes a hash of the structure of a module.
+ *
+ * @details The hash only depends on the expressions of the module, so it is stable across runs and platforms. It is
+ *          used to check that a parameter file was produced for the same network.
+ * */
+[[nodiscard]] auto
+hashModule(const Module& module) -> uint64_t;
+
+/**
+ * @brief Saves a module to a compact, versioned binary file, so that it can be reused without running the graph
+ *        construction again. See loadModule.
+ * */
+void
+saveModule(const Module& module, const std::filesystem::path& path);
+
+/**
+ * @brief Loads a module that was saved with saveModule.
+ *
+ * @details The file is mapped into memory and checked once. The returned module is read-only, and decodes the
+ *          expressions from the mapping while it is visited instead of allocating an object for each one, so loading
+ *          a large module is cheap. Copies of the module share the mapping.
+ * */
+[[nodiscard]] auto
+loadModule(const std::filesystem::path& path) -> std::unique_ptr<Module>;
+
 } // namespace axon
@@ -33,15 +33,80 @@ public:
 
   /**
    * @brief Call this function for creating modules that can be used for training the network.
+   *
+   * @details The first outputs of the module are the gradients of the parameters. They are followed by the auxiliary
+   *          outputs, which are the losses and then the given values, computed in the same forward pass.
+   *
+   * @param losses The values to differentiate. With more than one loss, the gradient is the weighted sum of the
+   *               gradients of the losses. The weights are read from one extra input per loss, which come after the
+   *               regular inputs, so that all of the losses share a single forward pass and a single reverse sweep.
+   *
+   * @param auxOutputs Additional forward values to output, such as the predictions of the network.
+   *
+   * @param checkpointSegments When greater than one, the forward pass is split into this many segments. The reverse
+   *                           sweep of each segment but the last starts by recomputing the segment from the values
+   *                           that flow into it, so that fewer forward values are live during the backward pass. This
+   *                           is ignored if boundaries were marked with markCheckpoint, which are used instead.
    * */
-  [[nodiscard]] virtual auto buildWithGrad(Value loss) -> std::unique_ptr<Module> = 0;
+  [[nodiscard]] virtual auto buildWithGrad(const std::vector<Value>& losses,
+                                           const std::vector<Value>& auxOutputs,
+                                           uint32_t checkpointSegments) -> std::unique_ptr<Module> = 0;
+
+  /**
+   * @brief Creates a module that backpropagates from the given outputs to the parameters.
+   *
+   * @details The gradient of the loss with respect to each output is read from an extra input, which come after the
+   *          regular inputs. The outputs of the module are the gradients of the parameters.
+   * */
+  [[nodiscard]] virtual auto buildBackward(const std::vector<Value>& outputs) -> std::unique_ptr<Module> = 0;
+
+  /**
+   * @brief Creates a module that propagates tangents forward from some of the inputs to the given outputs.
+   *
+   * @details The tangent of each of the given inputs is read from an extra input, which come after the regular
+   *          inputs. The outputs of the module are the tangents of the outputs, which is the Jacobian-vector product.
+   * */
+  [[nodiscard]] virtual auto buildJvp(const std::vector<Value>& outputs, const std::vector<Value>& tangentInputs)
+    -> std::unique_ptr<Module> = 0;
+
+  /**
+   * @brief Creates a module that computes the product of the Hessian of the loss with a vector.
+   *
+   * @details This applies forward-mode differentiation to the reverse sweep of the loss. The vector is read from one
+   *          extra input per parameter, which come after the regular inputs. The outputs are the elements of the
+   *          product, one per parameter.
+   * */
+  [[nodiscard]] virtual auto buildHvp(Value loss) -> std::unique_ptr<Module> = 0;
+
+  /**
+   * @brief Freezes a named group of parameters, so that modules built afterwards do not compute their gradients.
+   *
+   * @details Only the first element of a parameter array carries its name, so a group is the parameter with the
+   *          given name and the other elements of the array that it was created with. Unnamed parameters that were
+   *          created separately, such as the ones of axon::linear, are not part of the group.
+   * */
+  virtual void freeze(const std::string_view& name) = 0;
+
+  /**
+   * @brief Marks a boundary between two segments of the forward pass for gradient checkpointing, after the values that
+   *        were created so far.
+   *
+   * @details When boundaries are marked, buildWithGrad splits the forward pass at them instead of into segments of
+   *          the same size, and checkpoints even if no number of segments is given. Marking the end of each layer
+   *          keeps only the outputs of the layers live during the backward pass.
+   * */
+  virtual void markCheckpoint() = 0;
 
 protected:
   [[nodiscard]] virtual auto constant(float value) -> Value = 0;
 
-  [[nodiscard]] virtual auto param(const std::string_view& name) -> Value = 0;
+  /**
+   * @param size The number of elements of the array that the parameter is the first element of, which is one for
+   *             single parameters and for the other elements of arrays. See freeze.
+   * */
+  [[nodiscard]] virtual auto param(const std::string_view& name, uint32_t size, bool frozen) -> Value = 0;
 
-  [[nodiscard]] virtual auto input() -> Value = 0;
+  [[nodiscard]] virtual auto input(const std::string_view& group) -> Value = 0;
 
   [[nodiscard]] virtual auto add(Value left, Value right) -> Value = 0;
 
@@ -70,39 +135,51 @@ constant(const float value) -> Value
   return Value::constant(value);
 }
 
+/**
+ * @brief Creates an input of the network.
+ *
+ * @param group An optional input group. Inputs in the same group are updated together when the network is
+ *              re-evaluated incrementally, see axon_state_init and axon_update_<group> in the generated code.
+ * */
 [[nodiscard]] inline auto
-input() -> Value
+input(const std::string_view& group = "") -> Value
 {
-  return Value::input();
+  return Value::input(group);
 }
 
 template<uint32_t R, uint32_t C>
 [[nodiscard]] auto
-input() -> Matrix<Value, R, C>
+input(const std::string_view& group = "") -> Matrix<Value, R, C>
 {
   Matrix<Value, R, C> result;
 
   for (uint32_t i = 0; i < (R * C); i++) {
-    result.data[i] = Value::input();
+    result.data[i] = Value::input(group);
   }
 
   return result;
 }
 
+/**
+ * @brief Creates a parameter of the network.
+ *
+ * @param frozen Whether the parameter is excluded from training. Its gradient is then not computed, and the parts of
+ *               the backward pass that only lead to frozen parameters are skipped. This is useful for fine-tuning.
+ * */
 [[nodiscard]] inline auto
-param(const std::string_view& name = "") -> Value
+param(const std::string_view& name = "", const bool frozen = false) -> Value
 {
-  return Value::param(name);
+  return Value::param(name, frozen);
 }
 
 template<uint32_t R, uint32_t C>
 [[nodiscard]] auto
-param(const std::string_view& name = "") -> Matrix<Value, R, C>
+param(const std::string_view& name = "", const bool frozen = false) -> Matrix<Value, R, C>
 {
   Matrix<Value, R, C> result;
 
   for (uint32_t i = 0; i < (R * C); i++) {
-    result.data[i] = Value::param(name, i);
+    result.data[i] = Value::param(name, static_cast<size_t>(i), static_cast<size_t>(R * C), frozen);
   }
 
   return result;
@@ -12,11 +12,15 @@ class ModuleBuilder;
 class Value final
 {
 public:
-  [[nodiscard]] static auto input() -> Value;
+  [[nodiscard]] static auto input(const std::string_view& group = "") -> Value;
 
-  [[nodiscard]] static auto param(const std::string_view& name) -> Value;
+  [[nodiscard]] static auto param(const std::string_view& name, bool frozen = false) -> Value;
 
-  [[nodiscard]] static auto param(const std::string_view& name, size_t index) -> Value;
+  /**
+   * @brief Creates an element of a parameter array with the given number of elements. Only the first element is named.
+   * */
+  [[nodiscard]] static auto param(const std::string_view& name, size_t index, size_t size, bool frozen = false)
+    -> Value;
 
   [[nodiscard]] static auto constant(float value) -> Value;
 
@@ -1,169 +1,258 @@
 #include "c_exporter.hpp"
 
+#include "c_statement.hpp"
+#include "module_analysis.hpp"
+#include "subgraph_outliner.hpp"
+
+#include <axon/exception.hpp>
 #include <axon/expr.hpp>
 #include <axon/expr_visitor.hpp>
 #include <axon/module.hpp>
 
+#include <algorithm>
+#include <filesystem>
 #include <fstream>
+#include <iomanip>
+#include <map>
+#include <set>
 #include <sstream>
+#include <string>
 #include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 #include <assert.h>
+#include <ctype.h>
 #include <stddef.h>
 
 namespace axon {
 
 namespace {
 
+/* Must match AXON_PARAMS_NAME_SIZE in the generated parameter file code. */
+constexpr size_t paramsNameSize = 56;
+
+/* Checks whether a user-provided name can be used as part of a C function name. */
+[[nodiscard]] auto
+isIdentifier(const std::string_view& name) -> bool
+{
+  if (name.empty() || (isdigit(static_cast<unsigned char>(name[0])) != 0)) {
+    return false;
+  }
+
+  return std::all_of(name.begin(), name.end(), [](const char c) {
+    return (isalnum(static_cast<unsigned char>(c)) != 0) || (c == '_');
+  });
+}
+
+[[nodiscard]] auto
+toUpper(std::string name) -> std::string
+{
+  std::transform(name.begin(), name.end(), name.begin(), [](const char c) {
+    return static_cast<char>(toupper(static_cast<unsigned char>(c)));
+  });
+  return name;
+}
+
 /* This class is for emitting C code that represents the expressions in a module.
  * */
 class CExprWriter final : public ExprVisitor
 {
 public:
-  [[nodiscard]] auto source() const -> std::string { return m_source.str(); }
-
-  void visit(const InputExpr& e) override
+  /**
+   * @param accumulate When true, output statements are emitted as "output[i] += scale * v" instead of plain
+   *                   assignments. This is used for the gradient accumulation entry point.
+   * */
+  explicit CExprWriter(const bool accumulate = false)
+    : m_accumulate(accumulate)
   {
-    std::ostringstream tmp;
-    tmp << "input[" << e.index() << "]";
-    addExpr(tmp.str());
   }
 
-  void visit(const ParamExpr& e) override
-  {
-    std::ostringstream tmp;
-    tmp << "parameters[" << e.index() << "]";
-    addExpr(tmp.str());
-  }
+  using Statement = CStatement;
 
-  void visit(const ConstExpr& e) override
-  {
-    std::ostringstream tmp;
-    tmp << e.value();
-    addExpr(tmp.str());
-  }
+  using Op = CStatement::Op;
 
-  void visit(const NegateExpr& e) override
-  {
-    std::ostringstream tmp;
-    tmp << '-' << tmpName(e.operand());
-    addExpr(tmp.str());
-  }
+  using Access = CStatement::Access;
 
-  void visit(const RcpExpr& e) override
-  {
-    std::ostringstream tmp;
-    tmp << "1.0F / " << tmpName(e.operand());
-    addExpr(tmp.str());
-  }
+  [[nodiscard]] auto source() const -> std::string { return formatStatements(m_statements); }
 
-  void visit(const SqrtExpr& e) override
-  {
-    std::ostringstream tmp;
-    tmp << "sqrtf(" << tmpName(e.operand()) << ")";
-    addExpr(tmp.str());
-  }
+  [[nodiscard]] auto statements() const -> const std::vector<Statement>& { return m_statements; }
 
-  void visit(const ExpExpr& e) override
-  {
-    std::ostringstream tmp;
-    tmp << "expf(" << tmpName(e.operand()) << ")";
-    addExpr(tmp.str());
-  }
+  /**
+   * @brief Skips an expression. It must not be an operand of any expression that is emitted.
+   * */
+  void exclude(const uint32_t index) { m_excluded.emplace(index); }
 
-  void visit(const ReLUExpr& e) override
+  /**
+   * @brief Initializes the value of an expression from the given array element, instead of computing it.
+   * */
+  void substitute(const uint32_t index, Access source)
   {
-    std::ostringstream tmp;
-    tmp << "fmaxf(" << tmpName(e.operand()) << ", 0.0F)";
-    addExpr(tmp.str());
+    Statement statement;
+    statement.op = Op::load;
+    statement.access = std::move(source);
+    m_substitutes[index] = std::move(statement);
   }
 
-  void visit(const SigmoidExpr& e) override
+  /**
+   * @brief Initializes the value of an expression with the given constant, instead of computing it.
+   * */
+  void substituteConstant(const uint32_t index, std::string value)
   {
-    std::ostringstream tmp;
-    tmp << "1.0F / (1.0F + expf(-" << tmpName(e.operand()) << "))";
-    addExpr(tmp.str());
+    Statement statement;
+    statement.op = Op::constant;
+    statement.constant = std::move(value);
+    m_substitutes[index] = std::move(statement);
   }
 
-  void visit(const HeavisideExpr& e) override
-  {
-    std::ostringstream tmp;
-    tmp << tmpName(e.operand()) << " > 0.0F ? 1.0F : 0.0F";
-    addExpr(tmp.str());
-  }
+  /**
+   * @brief Assigns the value of an expression to the given array element, right after it is computed.
+   * */
+  void store(const uint32_t index, Access target) { m_stores[index] = std::move(target); }
 
-  void visit(const SinExpr& e) override
-  {
-    std::ostringstream tmp;
-    tmp << "sinf(" << tmpName(e.operand()) << ")";
-    addExpr(tmp.str());
-  }
+  /**
+   * @brief Subtracts an offset from the output indices, for functions that only write a range of the outputs.
+   * */
+  void offsetOutputs(const uint32_t offset) { m_outputOffset = offset; }
 
-  void visit(const CosExpr& e) override
+  /**
+   * @brief Writes the outputs starting at the given index to a second buffer, with the given name.
+   * */
+  void redirectOutputs(const uint32_t first, std::string buffer)
   {
-    std::ostringstream tmp;
-    tmp << "cosf(" << tmpName(e.operand()) << ")";
-    addExpr(tmp.str());
+    m_redirectFirst = first;
+    m_redirectBuffer = std::move(buffer);
   }
 
-  void visit(const AddExpr& e) override
+  /**
+   * @brief Only writes the outputs in the given map, each one to the output index that it maps to.
+   * */
+  void selectOutputs(std::map<uint32_t, uint32_t> outputs)
   {
-    std::ostringstream tmp;
-    tmp << tmpName(e.left()) << " + " << tmpName(e.right());
-    addExpr(tmp.str());
+    m_selectOutputs = true;
+    m_selectedOutputs = std::move(outputs);
   }
 
-  void visit(const SubExpr& e) override
-  {
-    std::ostringstream tmp;
-    tmp << tmpName(e.left()) << " - " << tmpName(e.right());
-    addExpr(tmp.str());
-  }
+  void visit(const InputExpr& e) override { addExpr(Op::load, { "input", e.index() }); }
+
+  void visit(const ParamExpr& e) override { addExpr(Op::param, { "parameters", e.index() }); }
 
-  void visit(const MulExpr& e) override
+  void visit(const ConstExpr& e) override
   {
     std::ostringstream tmp;
-    tmp << tmpName(e.left()) << " * " << tmpName(e.right());
-    addExpr(tmp.str());
+    tmp << e.value();
+    addExpr(Op::constant, {}, tmp.str());
   }
 
+  void visit(const NegateExpr& e) override { addExpr(Op::negate, e.operand()); }
+
+  void visit(const RcpExpr& e) override { addExpr(Op::rcp, e.operand()); }
+
+  void visit(const SqrtExpr& e) override { addExpr(Op::sqrt, e.operand()); }
+
+  void visit(const ExpExpr& e) override { addExpr(Op::exp, e.operand()); }
+
+  void visit(const ReLUExpr& e) override { addExpr(Op::relu, e.operand()); }
+
+  void visit(const SigmoidExpr& e) override { addExpr(Op::sigmoid, e.operand()); }
+
+  void visit(const HeavisideExpr& e) override { addExpr(Op::heaviside, e.operand()); }
+
+  void visit(const SinExpr& e) override { addExpr(Op::sin, e.operand()); }
+
+  void visit(const CosExpr& e) override { addExpr(Op::cos, e.operand()); }
+
+  void visit(const CheckpointExpr& e) override { addExpr(Op::checkpoint, e.operand()); }
+
+  void visit(const AddExpr& e) override { addExpr(Op::add, e.left(), e.right()); }
+
+  void visit(const SubExpr& e) override { addExpr(Op::sub, e.left(), e.right()); }
+
+  void visit(const MulExpr& e) override { addExpr(Op::mul, e.left(), e.right()); }
+
   void visit(const OutputExpr& e) override
   {
-    std::ostringstream tmp;
-    tmp << "output[" << e.outputIndex() << "] = " << tmpName(e.valueIndex()) << ';';
-    line(tmp.str());
+    if (m_excluded.count(m_counter) != 0) {
+      m_counter++;
+      return;
+    }
+    auto selected = m_selectedOutputs.end();
+    if (m_selectOutputs) {
+      selected = m_selectedOutputs.find(e.outputIndex());
+      if (selected == m_selectedOutputs.end()) {
+        m_counter++;
+        return;
+      }
+    }
+    const auto redirect = e.outputIndex() >= m_redirectFirst;
+    auto outputIndex = e.outputIndex() - (redirect ? m_redirectFirst : m_outputOffset);
+    if (selected != m_selectedOutputs.end()) {
+      outputIndex = selected->second;
+    }
+    Statement statement;
+    statement.operands.emplace_back(e.valueIndex());
+    statement.op = m_accumulate ? Op::accumulate : Op::output;
+    statement.access = { redirect ? m_redirectBuffer : std::string("output"), outputIndex };
+    m_statements.emplace_back(std::move(statement));
     m_counter++;
   }
 
 protected:
-  [[nodiscard]] auto tmpName(const uint32_t value) -> std::string
-  {
-    std::ostringstream stream;
-    stream << "v" << value;
-    return stream.str();
-  }
+  void addExpr(const Op op, const uint32_t operand) { addExpr(op, {}, {}, { operand }); }
 
-  void addExpr(const std::string_view& s)
-  {
-    std::ostringstream tmp;
-    tmp << "const float v" << m_counter << " = " << s << ";";
-    line(tmp.str());
-    m_counter++;
-  }
+  void addExpr(const Op op, const uint32_t left, const uint32_t right) { addExpr(op, {}, {}, { left, right }); }
 
-  void line(const std::string_view& s)
+  void addExpr(const Op op, Access access, std::string constant = {}, std::vector<uint32_t> operands = {})
   {
-    m_source << "  ";
-    m_source << s;
-    m_source << '\n';
-  }
+    const auto index = static_cast<uint32_t>(m_counter++);
+
+    if (m_excluded.count(index) != 0) {
+      return;
+    }
+
+    Statement statement;
+    const auto substitute = m_substitutes.find(index);
+    if (substitute != m_substitutes.end()) {
+      statement = substitute->second;
+    } else {
+      statement.operands = std::move(operands);
+      statement.op = op;
+      statement.access = std::move(access);
+      statement.constant = std::move(constant);
+    }
+    statement.values.emplace_back(index);
+
+    const auto store = m_stores.find(index);
+    if (store != m_stores.end()) {
+      statement.stores.emplace_back(index, store->second);
+    }
 
-  void line() { m_source << '\n'; }
+    m_statements.emplace_back(std::move(statement));
+  }
 
 private:
-  std::ostringstream m_source;
+  std::vector<Statement> m_statements;
 
   size_t m_counter{};
+
+  bool m_accumulate{ false };
+
+  uint32_t m_outputOffset{};
+
+  uint32_t m_redirectFirst{ UINT32_MAX };
+
+  std::string m_redirectBuffer;
+
+  bool m_selectOutputs{ false };
+
+  std::map<uint32_t, uint32_t> m_selectedOutputs;
+
+  std::set<uint32_t> m_excluded;
+
+  std::map<uint32_t, Statement> m_substitutes;
+
+  std::map<uint32_t, Access> m_stores;
 };
 
 const char macrosSrc[] = R"(/* performance macros */
@@ -189,6 +278,30 @@ const char macrosSrc[] = R"(/* performance macros */
 #    endif
 #  endif
 #endif
+
+/* Declares the functions that are defined in the generated source files, when there are any. */
+#ifndef AXON_EXTERN
+#  ifdef __cplusplus
+#    define AXON_EXTERN extern "C"
+#  else
+#    define AXON_EXTERN extern
+#  endif
+#endif
+
+/**
+ * @brief Returns its argument, but hides it from the optimizer.
+ *
+ * @details This is used by gradient checkpointing. Values that are recomputed in the backward pass start from a
+ *          checkpoint, so that the compiler does not merge them with the values of the forward pass.
+ * */
+inline static float
+axon_checkpoint(float x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  __asm__ volatile("" : "+m"(x));
+#endif
+  return x;
+}
 )";
 
 const char rngSrc[] = R"( /* RNG */
@@ -251,6 +364,107 @@ axon_rng_float_array(axon_rng_z* self, float* AXON_RESTRICT data, const size_t l
     data[i] = axon_rng_float(self) * scale + bias;
   }
 }
+
+/**
+ * @brief A stateless 64-bit mixing function (the finalizer of SplitMix64).
+ * */
+inline static uint64_t
+axon_mix64(uint64_t x)
+{
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+/**
+ * @brief A counter-based PRNG.
+ *
+ * @details The value at position i of a stream is a SplitMix64 hash of (key, i). Since values do not depend on each
+ *          other, arrays are filled by loops without a serial dependency, which compilers can vectorize, and any
+ *          position can be computed directly. Streams are split by hashing a stream index into the key, which gives
+ *          parallel workers independent sequences.
+ * */
+struct axon_crng
+{
+  uint64_t key;
+
+  uint64_t counter;
+};
+
+typedef struct axon_crng axon_crng_z;
+
+inline static void
+axon_crng_init(axon_crng_z* self, const uint64_t seed)
+{
+  self->key = axon_mix64(seed + 0x9e3779b97f4a7c15ULL);
+  self->counter = 0;
+}
+
+/**
+ * @brief Derives an independent stream, such as one per thread or per epoch.
+ * */
+inline static axon_crng_z
+axon_crng_split(const axon_crng_z* self, const uint64_t stream)
+{
+  axon_crng_z result;
+  result.key = axon_mix64(self->key ^ axon_mix64(stream + 0x632be59bd9b4e019ULL));
+  result.counter = 0;
+  return result;
+}
+
+/**
+ * @brief Computes the value at a given position of the stream, without changing the state.
+ * */
+inline static uint32_t
+axon_crng_at(const axon_crng_z* self, const uint64_t index)
+{
+  return (uint32_t)(axon_mix64(self->key + index * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+inline static uint32_t
+axon_crng(axon_crng_z* self)
+{
+  return axon_crng_at(self, self->counter++);
+}
+
+/**
+ * @brief Generates an integer in [a, b] with a multiply-shift, without a rejection loop.
+ *
+ * @details The bias is at most (b - a + 1) / 2^32, which is negligible for sampling and initialization.
+ * */
+inline static uint32_t
+axon_crng_range(axon_crng_z* self, const uint32_t a, const uint32_t b)
+{
+  const uint64_t range = ((uint64_t)(b - a)) + 1;
+  return a + (uint32_t)((((uint64_t)axon_crng(self)) * range) >> 32);
+}
+
+/**
+ * @brief Generates a float in [0, 1).
+ * */
+inline static float
+axon_crng_float(axon_crng_z* self)
+{
+  return ((float)(axon_crng(self) >> 8)) * (1.0F / 16777216.0F);
+}
+
+inline static void
+axon_crng_float_array(axon_crng_z* self,
+                      float* AXON_RESTRICT data,
+                      const size_t len,
+                      const float scale,
+                      const float bias)
+{
+  const uint64_t key = self->key;
+  const uint64_t counter = self->counter;
+
+  for (size_t i = 0; i < len; i++) {
+    const uint32_t r = (uint32_t)(axon_mix64(key + (counter + i) * 0x9e3779b97f4a7c15ULL) >> 32);
+    data[i] = ((float)(r >> 8)) * (1.0F / 16777216.0F) * scale + bias;
+  }
+
+  self->counter = counter + len;
+}
 )";
 
 const char optimizerSrc[] = R"(/* Optimizer */
@@ -275,6 +489,7 @@ typedef struct axon_opt axon_opt_z;
 inline static void
 axon_opt_init(axon_opt_z* self, const uint32_t seed)
 {
+  (void)seed;
   self->step = 0;
   for (size_t i = 0; i < (AXON_BUFFER_SIZE / sizeof(float)); i++) {
     self->gradient[i] = 0.0F;
@@ -298,78 +513,2560 @@ axon_opt_step(axon_opt_z* self, const float lr, const float momentum, float* AXO
 
   self->step++;
 }
-)";
 
-class ParamNameWriter final : public ExprVisitor
+/**
+ * @brief Clears the gradient buffer, so that a new mini-batch can be accumulated into it with axon_grad_accumulate.
+ * */
+inline static void
+axon_opt_zero_grad(axon_opt_z* self)
 {
-public:
-  explicit ParamNameWriter(std::ostream* output)
-    : m_output(output)
-  {
+  for (size_t i = 0; i < AXON_PARAMETERS; i++) {
+    self->gradient[i] = 0.0F;
   }
+}
 
-  void visit(const InputExpr&) override {}
+/**
+ * @brief Multiplies the gradient buffer by a constant factor.
+ *
+ * @details After accumulating N samples with a scale of 1, calling this with (1 / N) yields the mini-batch average.
+ * */
+inline static void
+axon_opt_scale_grad(axon_opt_z* self, const float scale)
+{
+  for (size_t i = 0; i < AXON_PARAMETERS; i++) {
+    self->gradient[i] *= scale;
+  }
+}
 
-  void visit(const ParamExpr& e) override
-  {
-    const auto name = e.name();
+/**
+ * @brief Averages a gradient that was accumulated over a given number of samples.
+ * */
+inline static void
+axon_opt_average_grad(axon_opt_z* self, const size_t samples)
+{
+  if (samples > 0) {
+    axon_opt_scale_grad(self, 1.0F / ((float)samples));
+  }
+}
 
-    if (!name.empty()) {
-      (*m_output) << "#define AXON_PARAMETER_" << name << ' ' << e.index() << std::endl;
-      m_numNames++;
-    }
+/* Sharded Gradients */
+
+/**
+ * @brief Computes the part of a mini-batch, or of the gradient, that belongs to a shard.
+ *
+ * @param granularity The range boundaries are multiples of this value (except for the last one).
+ * */
+inline static void
+axon_shard_range(const size_t count,
+                 const size_t granularity,
+                 const size_t shard,
+                 const size_t shards,
+                 size_t* begin,
+                 size_t* end)
+{
+  const size_t units = (count + granularity - 1) / granularity;
+  const size_t first = ((units * shard) / shards) * granularity;
+  const size_t last = ((units * (shard + 1)) / shards) * granularity;
+  *begin = (first < count) ? first : count;
+  *end = (last < count) ? last : count;
+}
+
+/**
+ * @brief Computes the gradient of one shard of a mini-batch, scaled by the reciprocal of the batch size.
+ *
+ * @param input The samples of the whole batch, stored contiguously with a stride of AXON_GRAD_INPUTS.
+ * */
+inline static void
+axon_grad_shard(const float* AXON_RESTRICT parameters,
+                const float* AXON_RESTRICT input,
+                const size_t batch_size,
+                const size_t shard,
+                const size_t shards,
+                float* AXON_RESTRICT output)
+{
+  for (size_t i = 0; i < AXON_PARAMETERS; i++) {
+    output[i] = 0.0F;
   }
 
-  void visit(const ConstExpr&) override {}
+  size_t first = 0;
+  size_t last = 0;
+  axon_shard_range(batch_size, 1, shard, shards, &first, &last);
 
-  void visit(const NegateExpr&) override {}
+  const float scale = 1.0F / ((float)batch_size);
 
-  void visit(const RcpExpr&) override {}
+  for (size_t i = first; i < last; i++) {
+    axon_grad_accumulate(parameters, input + i * AXON_GRAD_INPUTS, output, scale);
+  }
+}
 
-  void visit(const SqrtExpr&) override {}
+/**
+ * @brief Sums the shard gradients into the first buffer, over the elements [begin, end), with a pairwise tree.
+ *
+ * @details The buffers are AXON_BUFFER_SIZE bytes apart. Every parallel runtime reduces with this function, so
+ *          they all produce the same bits for the same number of shards.
+ * */
+inline static void
+axon_tree_reduce(float* buffers, const size_t shards, const size_t begin, const size_t end)
+{
+  const size_t buffer_stride = AXON_BUFFER_SIZE / sizeof(float);
 
-  void visit(const ExpExpr&) override {}
+  for (size_t stride = 1; stride < shards; stride *= 2) {
+    for (size_t t = 0; (t + stride) < shards; t += 2 * stride) {
+      float* AXON_RESTRICT dst = buffers + t * buffer_stride;
+      const float* AXON_RESTRICT src = buffers + (t + stride) * buffer_stride;
+      for (size_t i = begin; i < end; i++) {
+        dst[i] += src[i];
+      }
+    }
+  }
+}
 
-  void visit(const ReLUExpr&) override {}
+/**
+ * @brief Computes the average gradient of a mini-batch on the calling thread, with the same sharding and reduction
+ *        order as a parallel runtime with the given number of shards. The results are bit-identical.
+ *
+ * @param scratch Space for the shard gradients, which must be (shards * AXON_BUFFER_SIZE) bytes.
+ * */
+inline static void
+axon_grad_sharded(const float* AXON_RESTRICT parameters,
+                  const float* AXON_RESTRICT input,
+                  const size_t batch_size,
+                  const size_t shards,
+                  float* AXON_RESTRICT scratch,
+                  float* AXON_RESTRICT output)
+{
+  for (size_t i = 0; i < shards; i++) {
+    axon_grad_shard(parameters, input, batch_size, i, shards, scratch + i * (AXON_BUFFER_SIZE / sizeof(float)));
+  }
 
-  void visit(const SigmoidExpr&) override {}
+  axon_tree_reduce(scratch, shards, 0, AXON_PARAMETERS);
 
-  void visit(const HeavisideExpr&) override {}
+  for (size_t i = 0; i < AXON_PARAMETERS; i++) {
+    output[i] = scratch[i];
+  }
+}
+)";
 
-  void visit(const SinExpr&) override {}
+const char threadsSrc[] = R"(/* Thread Pool */
 
-  void visit(const CosExpr&) override {}
+#ifdef AXON_THREADS
 
-  void visit(const AddExpr&) override {}
+#include <pthread.h>
+#include <stdlib.h>
 
-  void visit(const SubExpr&) override {}
+#ifndef AXON_MAX_THREADS
+#define AXON_MAX_THREADS 64
+#endif
 
-  void visit(const MulExpr&) override {}
+/**
+ * @brief A reusable barrier, since pthread_barrier_t is not available on every POSIX platform.
+ * */
+struct axon_barrier
+{
+  pthread_mutex_t mutex;
 
-  void visit(const OutputExpr&) override {}
+  pthread_cond_t cond;
 
-  [[nodiscard]] auto numNames() const -> size_t { return m_numNames; }
+  size_t count;
 
-private:
-  std::ostream* m_output;
+  size_t waiting;
 
-  size_t m_numNames{};
+  size_t generation;
 };
 
-class CExporter final : public Exporter
+typedef struct axon_barrier axon_barrier_z;
+
+inline static void
+axon_barrier_init(axon_barrier_z* self, const size_t count)
 {
-public:
-  void exportFull(const Module& evalModule, const Module& gradModule, const std::filesystem::path& outputPath) override
-  {
-    std::ofstream f(outputPath);
-    f << "#pragma once" << std::endl;
-    f << std::endl;
-    f << "/* Note: This file is automatically generated. Edits may be lost. */" << std::endl;
-    f << std::endl;
-    f << "#include <stddef.h>" << std::endl;
-    f << "#include <stdint.h>" << std::endl;
-    f << "#include <math.h>" << std::endl;
-    f << "#include <limits.h>" << std::endl;
+  pthread_mutex_init(&self->mutex, NULL);
+  pthread_cond_init(&self->cond, NULL);
+  self->count = count;
+  self->waiting = 0;
+  self->generation = 0;
+}
+
+inline static void
+axon_barrier_destroy(axon_barrier_z* self)
+{
+  pthread_cond_destroy(&self->cond);
+  pthread_mutex_destroy(&self->mutex);
+}
+
+inline static void
+axon_barrier_resize(axon_barrier_z* self, const size_t count)
+{
+  pthread_mutex_lock(&self->mutex);
+  self->count = count;
+  pthread_mutex_unlock(&self->mutex);
+}
+
+inline static void
+axon_barrier_wait(axon_barrier_z* self)
+{
+  pthread_mutex_lock(&self->mutex);
+  const size_t generation = self->generation;
+  self->waiting++;
+  if (self->waiting == self->count) {
+    self->waiting = 0;
+    self->generation++;
+    pthread_cond_broadcast(&self->cond);
+  } else {
+    while (generation == self->generation) {
+      pthread_cond_wait(&self->cond, &self->mutex);
+    }
+  }
+  pthread_mutex_unlock(&self->mutex);
+}
+
+struct axon_pool;
+
+struct axon_pool_worker
+{
+  struct axon_pool* pool;
+
+  size_t id;
+
+  pthread_t thread;
+};
+
+/**
+ * @brief A pool of threads for synchronous, data-parallel gradient computation.
+ *
+ * @details Each thread computes the gradient of a fixed slice of the mini-batch into its own buffer. The buffers are
+ *          then summed with a pairwise tree reduction, where each thread reduces a cache-line aligned block of the
+ *          gradient. The order of every floating point operation only depends on the batch size and the number of
+ *          threads, so the results are deterministic for a fixed thread count. The calling thread acts as worker 0.
+ * */
+struct axon_pool
+{
+  size_t num_threads;
+
+  struct axon_pool_worker workers[AXON_MAX_THREADS];
+
+  float* gradients;
+
+  axon_barrier_z start;
+
+  axon_barrier_z computed;
+
+  axon_barrier_z done;
+
+  int shutdown;
+
+  const float* parameters;
+
+  const float* input;
+
+  size_t batch_size;
+
+  float* output;
+};
+
+typedef struct axon_pool axon_pool_z;
+
+inline static float*
+axon_pool_buffer(axon_pool_z* self, const size_t id)
+{
+  return self->gradients + id * (AXON_BUFFER_SIZE / sizeof(float));
+}
+
+inline static void
+axon_pool_run(axon_pool_z* self, const size_t id)
+{
+  const size_t n = self->num_threads;
+
+  axon_grad_shard(self->parameters, self->input, self->batch_size, id, n, axon_pool_buffer(self, id));
+
+  axon_barrier_wait(&self->computed);
+
+  size_t begin = 0;
+  size_t end = 0;
+  axon_shard_range(AXON_PARAMETERS, AXON_BUFFER_ALIGN / sizeof(float), id, n, &begin, &end);
+
+  axon_tree_reduce(self->gradients, n, begin, end);
+
+  const float* AXON_RESTRICT sum = axon_pool_buffer(self, 0);
+  float* AXON_RESTRICT output = self->output;
+  for (size_t i = begin; i < end; i++) {
+    output[i] = sum[i];
+  }
+}
+
+inline static void*
+axon_pool_main(void* arg)
+{
+  struct axon_pool_worker* worker = (struct axon_pool_worker*)arg;
+  axon_pool_z* self = worker->pool;
+
+  for (;;) {
+    axon_barrier_wait(&self->start);
+    if (self->shutdown) {
+      break;
+    }
+    axon_pool_run(self, worker->id);
+    axon_barrier_wait(&self->done);
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief Starts the worker threads of the pool.
+ *
+ * @param num_threads The total number of threads, including the calling thread. It is clamped to [1, AXON_MAX_THREADS].
+ *
+ * @return Zero on success, non-zero on failure.
+ * */
+inline static int
+axon_pool_init(axon_pool_z* self, size_t num_threads)
+{
+  num_threads = (num_threads < 1) ? 1 : num_threads;
+  num_threads = (num_threads > AXON_MAX_THREADS) ? AXON_MAX_THREADS : num_threads;
+
+  self->num_threads = num_threads;
+  self->shutdown = 0;
+  self->parameters = NULL;
+  self->input = NULL;
+  self->batch_size = 0;
+  self->output = NULL;
+
+  void* gradients = NULL;
+  if (posix_memalign(&gradients, AXON_BUFFER_ALIGN, num_threads * AXON_BUFFER_SIZE) != 0) {
+    return -1;
+  }
+  self->gradients = (float*)gradients;
+
+  axon_barrier_init(&self->start, num_threads);
+  axon_barrier_init(&self->computed, num_threads);
+  axon_barrier_init(&self->done, num_threads);
+
+  for (size_t i = 0; i < num_threads; i++) {
+    self->workers[i].pool = self;
+    self->workers[i].id = i;
+  }
+
+  for (size_t i = 1; i < num_threads; i++) {
+    if (pthread_create(&self->workers[i].thread, NULL, axon_pool_main, &self->workers[i]) != 0) {
+      /* Shrink the pool to the threads that did start. None of them can have passed a barrier yet. */
+      self->num_threads = i;
+      axon_barrier_resize(&self->start, i);
+      axon_barrier_resize(&self->computed, i);
+      axon_barrier_resize(&self->done, i);
+      break;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Computes the average gradient of a mini-batch.
+ *
+ * @param input The samples of the batch, stored contiguously with a stride of AXON_GRAD_INPUTS.
+ *
+ * @param output Where to store the average gradient (typically the gradient buffer of the optimizer).
+ * */
+inline static void
+axon_pool_grad(axon_pool_z* self,
+               const float* parameters,
+               const float* input,
+               const size_t batch_size,
+               float* output)
+{
+  if (batch_size == 0) {
+    return;
+  }
+
+  self->parameters = parameters;
+  self->input = input;
+  self->batch_size = batch_size;
+  self->output = output;
+
+  axon_barrier_wait(&self->start);
+  axon_pool_run(self, 0);
+  axon_barrier_wait(&self->done);
+}
+
+inline static void
+axon_pool_destroy(axon_pool_z* self)
+{
+  self->shutdown = 1;
+
+  axon_barrier_wait(&self->start);
+
+  for (size_t i = 1; i < self->num_threads; i++) {
+    pthread_join(self->workers[i].thread, NULL);
+  }
+
+  axon_barrier_destroy(&self->start);
+  axon_barrier_destroy(&self->computed);
+  axon_barrier_destroy(&self->done);
+
+  free(self->gradients);
+  self->gradients = NULL;
+}
+
+#endif /* AXON_THREADS */
+)";
+
+const char hogwildSrc[] = R"(/* Asynchronous (Hogwild) Training */
+
+#if defined(AXON_THREADS) && defined(AXON_HOGWILD)
+
+/**
+ * @brief Called by the worker threads to produce a training sample.
+ *
+ * @param user The user data passed to axon_hogwild_run.
+ *
+ * @param thread_id The index of the calling worker thread.
+ *
+ * @param input Where to write the AXON_GRAD_INPUTS values of the sample.
+ * */
+typedef void (*axon_sample_fn)(void* user, size_t thread_id, float* input);
+
+enum axon_hogwild_mode
+{
+  /* Updates are applied with relaxed atomic compare-and-swap additions and the parameters are read with relaxed
+   * atomic loads. Updates from different threads are never lost. */
+  AXON_HOGWILD_ATOMIC,
+  /* Updates are applied with plain, unsynchronized loads and stores. This is a data race by the rules of C and C++,
+   * and updates may be lost, but it is the fastest mode and the one originally described by Hogwild. */
+  AXON_HOGWILD_RACY
+};
+
+struct axon_hogwild;
+
+struct axon_hogwild_worker
+{
+  struct axon_hogwild* hogwild;
+
+  size_t id;
+
+  pthread_t thread;
+
+  float* gradient;
+
+  float* momentum;
+
+  float* snapshot;
+};
+
+/**
+ * @brief Trains a set of shared parameters from several threads without locks.
+ *
+ * @details Every thread keeps its own momentum state and applies its update directly to the shared parameters.
+ *          Only non-zero updates are written, so networks with sparse gradients see little contention.
+ * */
+struct axon_hogwild
+{
+  size_t num_threads;
+
+  enum axon_hogwild_mode mode;
+
+  struct axon_hogwild_worker workers[AXON_MAX_THREADS];
+
+  float* buffers;
+
+  float* parameters;
+
+  size_t steps;
+
+  float lr;
+
+  float momentum;
+
+  axon_sample_fn sample;
+
+  void* user;
+};
+
+typedef struct axon_hogwild axon_hogwild_z;
+
+inline static void
+axon_atomic_add(float* target, const float value)
+{
+  float expected;
+  float desired;
+  __atomic_load(target, &expected, __ATOMIC_RELAXED);
+  do {
+    desired = expected + value;
+  } while (!__atomic_compare_exchange(target, &expected, &desired, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+inline static void*
+axon_hogwild_main(void* arg)
+{
+  struct axon_hogwild_worker* worker = (struct axon_hogwild_worker*)arg;
+  axon_hogwild_z* self = worker->hogwild;
+
+  float* AXON_RESTRICT g = worker->gradient;
+  float* AXON_RESTRICT m = worker->momentum;
+  float* parameters = self->parameters;
+  const float lr = self->lr;
+  const float beta = self->momentum;
+
+  float input[AXON_GRAD_INPUTS];
+
+  for (size_t step = 0; step < self->steps; step++) {
+
+    self->sample(self->user, worker->id, input);
+
+    if (self->mode == AXON_HOGWILD_ATOMIC) {
+      float* AXON_RESTRICT snapshot = worker->snapshot;
+      for (size_t i = 0; i < AXON_PARAMETERS; i++) {
+        __atomic_load(&parameters[i], &snapshot[i], __ATOMIC_RELAXED);
+      }
+      axon_grad(snapshot, input, g);
+    } else {
+      axon_grad(parameters, input, g);
+    }
+
+    for (size_t i = 0; i < AXON_PARAMETERS; i++) {
+      const float mi = m[i] * beta + g[i] * (1.0F - beta);
+      m[i] = mi;
+      if (mi == 0.0F) {
+        continue;
+      }
+      if (self->mode == AXON_HOGWILD_ATOMIC) {
+        axon_atomic_add(&parameters[i], -mi * lr);
+      } else {
+        parameters[i] -= mi * lr;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief Allocates the per-thread gradient and momentum buffers.
+ *
+ * @return Zero on success, non-zero on failure.
+ * */
+inline static int
+axon_hogwild_init(axon_hogwild_z* self, size_t num_threads, const enum axon_hogwild_mode mode)
+{
+  num_threads = (num_threads < 1) ? 1 : num_threads;
+  num_threads = (num_threads > AXON_MAX_THREADS) ? AXON_MAX_THREADS : num_threads;
+
+  self->num_threads = num_threads;
+  self->mode = mode;
+
+  void* buffers = NULL;
+  if (posix_memalign(&buffers, AXON_BUFFER_ALIGN, num_threads * 3 * AXON_BUFFER_SIZE) != 0) {
+    return -1;
+  }
+  self->buffers = (float*)buffers;
+
+  const size_t stride = AXON_BUFFER_SIZE / sizeof(float);
+
+  for (size_t i = 0; i < num_threads; i++) {
+    struct axon_hogwild_worker* worker = &self->workers[i];
+    worker->hogwild = self;
+    worker->id = i;
+    worker->gradient = self->buffers + (i * 3 + 0) * stride;
+    worker->momentum = self->buffers + (i * 3 + 1) * stride;
+    worker->snapshot = self->buffers + (i * 3 + 2) * stride;
+    for (size_t j = 0; j < stride; j++) {
+      worker->momentum[j] = 0.0F;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Runs a number of asynchronous training steps on each thread and waits for them to finish.
+ *
+ * @details The momentum state of each thread is kept between calls, so this can be called repeatedly
+ *          (for example once per epoch, with a validation pass in between).
+ *
+ * @return Zero on success, non-zero if the threads could not be started.
+ * */
+inline static int
+axon_hogwild_run(axon_hogwild_z* self,
+                 float* parameters,
+                 const size_t steps_per_thread,
+                 const float lr,
+                 const float momentum,
+                 axon_sample_fn sample,
+                 void* user)
+{
+  self->parameters = parameters;
+  self->steps = steps_per_thread;
+  self->lr = lr;
+  self->momentum = momentum;
+  self->sample = sample;
+  self->user = user;
+
+  size_t started = 1;
+  for (; started < self->num_threads; started++) {
+    struct axon_hogwild_worker* worker = &self->workers[started];
+    if (pthread_create(&worker->thread, NULL, axon_hogwild_main, worker) != 0) {
+      break;
+    }
+  }
+
+  axon_hogwild_main(&self->workers[0]);
+
+  for (size_t i = 1; i < started; i++) {
+    pthread_join(self->workers[i].thread, NULL);
+  }
+
+  return (started == self->num_threads) ? 0 : -1;
+}
+
+inline static void
+axon_hogwild_destroy(axon_hogwild_z* self)
+{
+  free(self->buffers);
+  self->buffers = NULL;
+}
+
+#endif /* defined(AXON_THREADS) && defined(AXON_HOGWILD) */
+)";
+
+const char shmSrc[] = R"(/* Multi-Process Training */
+
+#ifdef AXON_SHM
+
+#include <fcntl.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * @brief The header at the start of the shared memory segment.
+ *
+ * @details After the header, the segment holds one gradient slot per rank followed by two result slots, each of
+ *          AXON_BUFFER_SIZE bytes. The result slots alternate between calls to axon_comm_allreduce, so that a fast
+ *          rank can start the next reduction while a slow rank is still reading the previous result.
+ * */
+struct axon_shm_header
+{
+  uint32_t num_ranks;
+
+  uint32_t barrier_count;
+
+  uint32_t barrier_sense;
+
+  uint32_t failed;
+};
+
+#define AXON_SHM_HEADER_SIZE \
+  (((sizeof(struct axon_shm_header) + (AXON_BUFFER_ALIGN - 1)) / AXON_BUFFER_ALIGN) * AXON_BUFFER_ALIGN)
+
+#define AXON_SHM_SIZE(num_ranks) (AXON_SHM_HEADER_SIZE + ((num_ranks) + 2) * AXON_BUFFER_SIZE)
+
+/**
+ * @brief A process-local handle to a shared memory segment for exchanging gradients.
+ * */
+struct axon_comm
+{
+  struct axon_shm_header* header;
+
+  float* slots;
+
+  size_t size;
+
+  uint32_t rank;
+
+  uint32_t num_ranks;
+
+  uint32_t sense;
+
+  uint32_t step;
+};
+
+typedef struct axon_comm axon_comm_z;
+
+inline static float*
+axon_comm_slot(axon_comm_z* self, const size_t index)
+{
+  return self->slots + index * (AXON_BUFFER_SIZE / sizeof(float));
+}
+
+inline static int
+axon_comm_map(axon_comm_z* self, const int fd, const uint32_t rank, const uint32_t num_ranks)
+{
+  self->size = AXON_SHM_SIZE(num_ranks);
+
+  void* base = mmap(NULL, self->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    return -1;
+  }
+
+  self->header = (struct axon_shm_header*)base;
+  self->slots = (float*)(((char*)base) + AXON_SHM_HEADER_SIZE);
+  self->rank = rank;
+  self->num_ranks = num_ranks;
+  self->sense = 0;
+  self->step = 0;
+  return 0;
+}
+
+/**
+ * @brief Creates a new shared memory segment, with the caller as rank 0.
+ *
+ * @param name The POSIX shared memory name, such as "/axon_train".
+ *
+ * @return Zero on success, non-zero on failure.
+ * */
+inline static int
+axon_comm_create(axon_comm_z* self, const char* name, const uint32_t num_ranks)
+{
+  const int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    return -1;
+  }
+
+  if ((ftruncate(fd, (off_t)AXON_SHM_SIZE(num_ranks)) != 0) || (axon_comm_map(self, fd, 0, num_ranks) != 0)) {
+    close(fd);
+    shm_unlink(name);
+    return -1;
+  }
+
+  close(fd);
+
+  memset(self->header, 0, AXON_SHM_HEADER_SIZE);
+  self->header->num_ranks = num_ranks;
+  return 0;
+}
+
+/**
+ * @brief Attaches to a segment created by another process with axon_comm_create.
+ *
+ * @return Zero on success, non-zero on failure.
+ * */
+inline static int
+axon_comm_attach(axon_comm_z* self, const char* name, const uint32_t rank, const uint32_t num_ranks)
+{
+  const int fd = shm_open(name, O_RDWR, 0600);
+  if (fd < 0) {
+    return -1;
+  }
+
+  const int result = axon_comm_map(self, fd, rank, num_ranks);
+
+  close(fd);
+
+  return result;
+}
+
+/**
+ * @brief Unmaps the segment. The creator should also call shm_unlink once every rank has detached.
+ * */
+inline static void
+axon_comm_detach(axon_comm_z* self)
+{
+  munmap(self->header, self->size);
+  self->header = NULL;
+  self->slots = NULL;
+}
+
+/**
+ * @brief A sense-reversing spin barrier across all ranks.
+ *
+ * @return Zero on success, non-zero if another rank has failed.
+ * */
+inline static int
+axon_comm_barrier(axon_comm_z* self)
+{
+  struct axon_shm_header* header = self->header;
+
+  self->sense = !self->sense;
+
+  if (__atomic_add_fetch(&header->barrier_count, 1, __ATOMIC_ACQ_REL) == self->num_ranks) {
+    __atomic_store_n(&header->barrier_count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&header->barrier_sense, self->sense, __ATOMIC_RELEASE);
+    return 0;
+  }
+
+  while (__atomic_load_n(&header->barrier_sense, __ATOMIC_ACQUIRE) != self->sense) {
+    if (__atomic_load_n(&header->failed, __ATOMIC_RELAXED)) {
+      return -1;
+    }
+    sched_yield();
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Sums the gradient of every rank and stores the result in the gradient of every rank.
+ *
+ * @details This is a reduce-scatter followed by an all-gather through shared memory. Each rank sums one cache-line
+ *          aligned block of the gradient with axon_tree_reduce, so the results are bit-identical to axon_pool and
+ *          axon_grad_sharded with the same number of shards.
+ *
+ * @return Zero on success, non-zero if another rank has failed.
+ * */
+inline static int
+axon_comm_allreduce(axon_comm_z* self, float* gradient)
+{
+  float* AXON_RESTRICT slot = axon_comm_slot(self, self->rank);
+  for (size_t i = 0; i < AXON_PARAMETERS; i++) {
+    slot[i] = gradient[i];
+  }
+
+  if (axon_comm_barrier(self) != 0) {
+    return -1;
+  }
+
+  size_t begin = 0;
+  size_t end = 0;
+  axon_shard_range(AXON_PARAMETERS, AXON_BUFFER_ALIGN / sizeof(float), self->rank, self->num_ranks, &begin, &end);
+
+  axon_tree_reduce(self->slots, self->num_ranks, begin, end);
+
+  const float* AXON_RESTRICT sum = axon_comm_slot(self, 0);
+  float* AXON_RESTRICT result = axon_comm_slot(self, self->num_ranks + (self->step & 1));
+  for (size_t i = begin; i < end; i++) {
+    result[i] = sum[i];
+  }
+
+  if (axon_comm_barrier(self) != 0) {
+    return -1;
+  }
+
+  for (size_t i = 0; i < AXON_PARAMETERS; i++) {
+    gradient[i] = result[i];
+  }
+
+  self->step++;
+
+  return 0;
+}
+
+/**
+ * @brief Computes the average gradient of a mini-batch, where each rank computes one shard of it.
+ *
+ * @details Every rank has to pass the same parameters and batch.
+ *
+ * @return Zero on success, non-zero if another rank has failed.
+ * */
+inline static int
+axon_comm_grad(axon_comm_z* self, const float* parameters, const float* input, const size_t batch_size, float* output)
+{
+  axon_grad_shard(parameters, input, batch_size, self->rank, self->num_ranks, output);
+
+  return axon_comm_allreduce(self, output);
+}
+
+typedef int (*axon_rank_fn)(axon_comm_z* comm, void* user);
+
+/**
+ * @brief Forks one worker process per rank of a segment created with axon_comm_create and waits for them to exit.
+ *
+ * @details Each worker calls the given function with its own handle to the segment. If a worker fails, the others
+ *          are released from their barriers so that they can exit as well. The segment stays mapped in the calling
+ *          process, so any results that the workers leave in it can be read afterwards.
+ *
+ * @return Zero if every worker returned zero, non-zero otherwise.
+ * */
+inline static int
+axon_comm_launch(axon_comm_z* self, axon_rank_fn fn, void* user)
+{
+  const uint32_t num_ranks = self->num_ranks;
+
+  int result = 0;
+
+  uint32_t started = 0;
+
+  for (; started < num_ranks; started++) {
+    const pid_t pid = fork();
+    if (pid < 0) {
+      __atomic_store_n(&self->header->failed, 1, __ATOMIC_RELAXED);
+      result = -1;
+      break;
+    }
+    if (pid == 0) {
+      axon_comm_z comm = *self;
+      comm.rank = started;
+      _exit((fn(&comm, user) == 0) ? 0 : 1);
+    }
+  }
+
+  for (uint32_t i = 0; i < started; i++) {
+    int status = 0;
+    const pid_t pid = wait(&status);
+    if ((pid < 0) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+      __atomic_store_n(&self->header->failed, 1, __ATOMIC_RELAXED);
+      result = -1;
+    }
+  }
+
+  return result;
+}
+
+#endif /* AXON_SHM */
+)";
+
+const char paramsFileSrc[] = R"(/* Parameter Files */
+
+#ifdef AXON_PARAMS_FILE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* The file starts with the header below, followed by the name table. The parameters and the optional optimizer
+ * state come after that, each aligned to AXON_BUFFER_ALIGN bytes, so that they can be used in place once the file is
+ * mapped into memory. All values are stored in the byte order of the machine that wrote the file. */
+
+#define AXON_PARAMS_MAGIC "AXONPRM"
+
+#define AXON_PARAMS_VERSION 1
+
+#define AXON_PARAMS_NAME_SIZE 56
+
+#define AXON_PARAMS_ROUND_UP(x) ((((x) + (AXON_BUFFER_ALIGN - 1)) / AXON_BUFFER_ALIGN) * AXON_BUFFER_ALIGN)
+
+struct axon_params_header
+{
+  char magic[8];
+
+  uint32_t version;
+
+  uint32_t num_parameters;
+
+  uint64_t graph_hash;
+
+  uint64_t file_size;
+
+  uint64_t names_offset;
+
+  uint64_t num_names;
+
+  uint64_t parameters_offset;
+
+  /* Zero if the file does not contain any optimizer state. */
+  uint64_t optimizer_offset;
+
+  uint64_t optimizer_step;
+};
+
+struct axon_params_name
+{
+  uint64_t offset;
+
+  char name[AXON_PARAMS_NAME_SIZE];
+};
+
+#ifdef __cplusplus
+#define AXON_PARAMS_NAME_ALIGN alignof(struct axon_params_name)
+#else
+#define AXON_PARAMS_NAME_ALIGN _Alignof(struct axon_params_name)
+#endif
+)";
+
+const char paramsFileFunctionsSrc[] = R"(
+/**
+ * @brief A parameter file that is mapped into memory.
+ * */
+struct axon_params
+{
+  void* base;
+
+  size_t size;
+
+  const struct axon_params_header* header;
+
+  /* Points into the mapping. It may only be written to if the file was mapped as writable. */
+  float* parameters;
+
+  /* The momentum of the optimizer, or null if the file does not contain any optimizer state. */
+  float* momentum;
+};
+
+typedef struct axon_params axon_params_z;
+
+inline static int
+axon_params_pad(FILE* file, size_t from, const size_t to)
+{
+  for (; from < to; from++) {
+    if (fputc(0, file) == EOF) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Writes the parameters, and optionally the state of the optimizer, to a file.
+ *
+ * @details The file is written next to the destination and then renamed, so that processes which have the old file
+ *          mapped are not affected.
+ *
+ * @param opt The optimizer state to store, or null to only store the parameters.
+ *
+ * @return Zero on success, non-zero on failure.
+ * */
+inline static int
+axon_params_save(const char* path, const float* parameters, const axon_opt_z* opt)
+{
+  struct axon_params_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, AXON_PARAMS_MAGIC, sizeof(header.magic));
+  header.version = AXON_PARAMS_VERSION;
+  header.num_parameters = AXON_PARAMETERS;
+  header.graph_hash = AXON_GRAPH_HASH;
+  header.names_offset = sizeof(header);
+  header.num_names = AXON_PARAMS_NAMES;
+  header.parameters_offset =
+    AXON_PARAMS_ROUND_UP(header.names_offset + header.num_names * sizeof(struct axon_params_name));
+  header.file_size = header.parameters_offset + AXON_PARAMETERS * sizeof(float);
+  if (opt) {
+    header.optimizer_offset = AXON_PARAMS_ROUND_UP(header.file_size);
+    header.optimizer_step = opt->step;
+    header.file_size = header.optimizer_offset + AXON_PARAMETERS * sizeof(float);
+  }
+
+  char tmp_path[4096];
+  if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+    return -1;
+  }
+
+  FILE* file = fopen(tmp_path, "wb");
+  if (!file) {
+    return -1;
+  }
+
+  int failed = fwrite(&header, sizeof(header), 1, file) != 1;
+
+#if AXON_PARAMS_NAMES > 0
+  failed = failed || (fwrite(axon_params_names, sizeof(axon_params_names), 1, file) != 1);
+#endif
+
+  const size_t names_end = header.names_offset + header.num_names * sizeof(struct axon_params_name);
+  failed = failed || axon_params_pad(file, names_end, header.parameters_offset);
+  failed = failed || (fwrite(parameters, sizeof(float), AXON_PARAMETERS, file) != AXON_PARAMETERS);
+
+  if (opt) {
+    const size_t parameters_end = header.parameters_offset + AXON_PARAMETERS * sizeof(float);
+    failed = failed || axon_params_pad(file, parameters_end, header.optimizer_offset);
+    const float* momentum = opt->momentum[opt->step & 1];
+    failed = failed || (fwrite(momentum, sizeof(float), AXON_PARAMETERS, file) != AXON_PARAMETERS);
+  }
+
+  failed = (fclose(file) != 0) || failed;
+
+  if (failed || (rename(tmp_path, path) != 0)) {
+    remove(tmp_path);
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Checks that a range of the file is within its size. The offsets and counts come from the file, so the comparisons
+ * are written such that they cannot overflow. */
+inline static int
+axon_params_in_file(const uint64_t offset, const uint64_t count, const size_t element_size, const size_t size)
+{
+  return (offset <= size) && (count <= ((size - offset) / element_size));
+}
+
+inline static int
+axon_params_valid(const struct axon_params_header* header, const size_t size)
+{
+  return (memcmp(header->magic, AXON_PARAMS_MAGIC, sizeof(header->magic)) == 0) &&
+         (header->version == AXON_PARAMS_VERSION) && (header->num_parameters == AXON_PARAMETERS) &&
+         (header->graph_hash == AXON_GRAPH_HASH) && (header->file_size <= size) &&
+         ((header->names_offset % AXON_PARAMS_NAME_ALIGN) == 0) &&
+         axon_params_in_file(header->names_offset, header->num_names, sizeof(struct axon_params_name), size) &&
+         ((header->parameters_offset % AXON_BUFFER_ALIGN) == 0) &&
+         axon_params_in_file(header->parameters_offset, AXON_PARAMETERS, sizeof(float), size) &&
+         ((header->optimizer_offset % AXON_BUFFER_ALIGN) == 0) &&
+         axon_params_in_file(header->optimizer_offset, AXON_PARAMETERS, sizeof(float), size);
+}
+
+/**
+ * @brief Maps a parameter file into memory, so that the parameters can be used without copying them.
+ *
+ * @details The file is checked against the network that this header was generated for. A read-only mapping is
+ *          private, so pages are only loaded as they are touched. A writable mapping is shared, so updates to the
+ *          parameters are written back to the file.
+ *
+ * @return Zero on success, non-zero if the file cannot be mapped or does not belong to this network.
+ * */
+inline static int
+axon_params_map(axon_params_z* self, const char* path, const int writable)
+{
+  memset(self, 0, sizeof(*self));
+
+  const int fd = open(path, writable ? O_RDWR : O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+
+  struct stat info;
+  if ((fstat(fd, &info) != 0) || (((size_t)info.st_size) < sizeof(struct axon_params_header))) {
+    close(fd);
+    return -1;
+  }
+
+  const size_t size = (size_t)info.st_size;
+  const int prot = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+  void* base = mmap(NULL, size, prot, writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    return -1;
+  }
+
+  const struct axon_params_header* header = (const struct axon_params_header*)base;
+  if (!axon_params_valid(header, size)) {
+    munmap(base, size);
+    return -1;
+  }
+
+  self->base = base;
+  self->size = size;
+  self->header = header;
+  self->parameters = (float*)(((char*)base) + header->parameters_offset);
+  self->momentum = header->optimizer_offset ? (float*)(((char*)base) + header->optimizer_offset) : NULL;
+  return 0;
+}
+
+inline static void
+axon_params_unmap(axon_params_z* self)
+{
+  if (self->base) {
+    munmap(self->base, self->size);
+  }
+  memset(self, 0, sizeof(*self));
+}
+
+/**
+ * @brief Looks up the offset of a named parameter in the name table of a mapped file.
+ *
+ * @return The offset of the parameter, or -1 if there is no parameter with the given name.
+ * */
+inline static long
+axon_params_find(const axon_params_z* self, const char* name)
+{
+  const struct axon_params_name* names =
+    (const struct axon_params_name*)(((const char*)self->base) + self->header->names_offset);
+
+  for (uint64_t i = 0; i < self->header->num_names; i++) {
+    if (strncmp(names[i].name, name, AXON_PARAMS_NAME_SIZE) == 0) {
+      return (long)names[i].offset;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * @brief Restores the state of an optimizer from a mapped file, in order to resume training.
+ *
+ * @return Zero on success, non-zero if the file does not contain any optimizer state.
+ * */
+inline static int
+axon_opt_restore(axon_opt_z* self, const axon_params_z* params)
+{
+  if (!params->momentum) {
+    return -1;
+  }
+
+  axon_opt_init(self, 0);
+  self->step = (size_t)params->header->optimizer_step;
+  float* momentum = self->momentum[self->step & 1];
+  for (size_t i = 0; i < AXON_PARAMETERS; i++) {
+    momentum[i] = params->momentum[i];
+  }
+  return 0;
+}
+
+#endif /* AXON_PARAMS_FILE */
+)";
+
+const char datasetSrc[] = R"(/* Datasets */
+
+#ifdef AXON_DATASET
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* A dataset file is a header followed by fixed-size records, starting at an offset aligned to AXON_BUFFER_ALIGN.
+ * Each record has the layout of the input of axon_grad (AXON_GRAD_INPUTS floats), so a run of consecutive records is
+ * a mini-batch that can be passed to axon_pool_grad or axon_grad_sharded as is. */
+
+#define AXON_DATASET_MAGIC "AXONDAT"
+
+#define AXON_DATASET_VERSION 1
+
+struct axon_dataset_header
+{
+  char magic[8];
+
+  uint32_t version;
+
+  uint32_t record_size;
+
+  uint64_t num_records;
+
+  uint64_t data_offset;
+};
+
+#define AXON_DATASET_DATA_OFFSET \
+  (((sizeof(struct axon_dataset_header) + (AXON_BUFFER_ALIGN - 1)) / AXON_BUFFER_ALIGN) * AXON_BUFFER_ALIGN)
+
+/**
+ * @brief Writes records to a new dataset file.
+ * */
+struct axon_dataset_writer
+{
+  FILE* file;
+
+  uint64_t num_records;
+};
+
+typedef struct axon_dataset_writer axon_dataset_writer_z;
+
+/**
+ * @return Zero on success, non-zero on failure.
+ * */
+inline static int
+axon_dataset_create(axon_dataset_writer_z* self, const char* path)
+{
+  self->num_records = 0;
+  self->file = fopen(path, "wb");
+  if (!self->file) {
+    return -1;
+  }
+
+  for (size_t i = 0; i < AXON_DATASET_DATA_OFFSET; i++) {
+    if (fputc(0, self->file) == EOF) {
+      fclose(self->file);
+      self->file = NULL;
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Appends a number of records, each of AXON_GRAD_INPUTS floats, to the dataset.
+ *
+ * @return Zero on success, non-zero on failure.
+ * */
+inline static int
+axon_dataset_append(axon_dataset_writer_z* self, const float* records, const size_t count)
+{
+  if (fwrite(records, AXON_GRAD_INPUTS * sizeof(float), count, self->file) != count) {
+    return -1;
+  }
+
+  self->num_records += count;
+  return 0;
+}
+
+/**
+ * @brief Writes the header and closes the file.
+ *
+ * @return Zero on success, non-zero on failure.
+ * */
+inline static int
+axon_dataset_finish(axon_dataset_writer_z* self)
+{
+  struct axon_dataset_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, AXON_DATASET_MAGIC, sizeof(header.magic));
+  header.version = AXON_DATASET_VERSION;
+  header.record_size = AXON_GRAD_INPUTS;
+  header.num_records = self->num_records;
+  header.data_offset = AXON_DATASET_DATA_OFFSET;
+
+  int failed = (fseek(self->file, 0, SEEK_SET) != 0) || (fwrite(&header, sizeof(header), 1, self->file) != 1);
+  failed = (fclose(self->file) != 0) || failed;
+  self->file = NULL;
+  return failed ? -1 : 0;
+}
+
+/**
+ * @brief A dataset file that is mapped into memory.
+ * */
+struct axon_dataset
+{
+  void* base;
+
+  size_t size;
+
+  const float* records;
+
+  size_t num_records;
+};
+
+typedef struct axon_dataset axon_dataset_z;
+
+/**
+ * @return Zero on success, non-zero if the file cannot be mapped or its records do not match AXON_GRAD_INPUTS.
+ * */
+inline static int
+axon_dataset_map(axon_dataset_z* self, const char* path)
+{
+  memset(self, 0, sizeof(*self));
+
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+
+  struct stat info;
+  if ((fstat(fd, &info) != 0) || (((size_t)info.st_size) < sizeof(struct axon_dataset_header))) {
+    close(fd);
+    return -1;
+  }
+
+  const size_t size = (size_t)info.st_size;
+  void* base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    return -1;
+  }
+
+  const struct axon_dataset_header* header = (const struct axon_dataset_header*)base;
+  const uint64_t record_bytes = AXON_GRAD_INPUTS * sizeof(float);
+  if ((memcmp(header->magic, AXON_DATASET_MAGIC, sizeof(header->magic)) != 0) ||
+      (header->version != AXON_DATASET_VERSION) || (header->record_size != AXON_GRAD_INPUTS) ||
+      ((header->data_offset % sizeof(float)) != 0) || (header->data_offset > size) ||
+      (header->num_records > ((size - header->data_offset) / record_bytes)) || (header->num_records > UINT32_MAX)) {
+    munmap(base, size);
+    return -1;
+  }
+
+  self->base = base;
+  self->size = size;
+  self->records = (const float*)(((const char*)base) + header->data_offset);
+  self->num_records = (size_t)header->num_records;
+  return 0;
+}
+
+inline static void
+axon_dataset_unmap(axon_dataset_z* self)
+{
+  if (self->base) {
+    munmap(self->base, self->size);
+  }
+  memset(self, 0, sizeof(*self));
+}
+
+/**
+ * @brief Hands out shuffled mini-batches of a dataset, with a new permutation for every epoch.
+ * */
+struct axon_sampler
+{
+  uint32_t* order;
+
+  uint32_t* swaps;
+
+  float* batch;
+
+  size_t num_records;
+
+  size_t batch_size;
+
+  size_t position;
+
+  uint64_t seed;
+
+  uint64_t epoch;
+};
+
+typedef struct axon_sampler axon_sampler_z;
+
+/**
+ * @brief Computes the permutation of an epoch.
+ *
+ * @details The swap targets of the Fisher-Yates shuffle come from a counter-based stream of the epoch, so they are
+ *          computed in a loop without dependencies between iterations, and bounded with a multiply-shift instead of
+ *          a rejection loop. Only the swaps themselves are serial.
+ * */
+inline static void
+axon_sampler_shuffle(axon_sampler_z* self)
+{
+  const size_t n = self->num_records;
+
+  axon_crng_z rng;
+  axon_crng_init(&rng, self->seed);
+  const axon_crng_z stream = axon_crng_split(&rng, self->epoch);
+
+  uint32_t* AXON_RESTRICT swaps = self->swaps;
+  for (size_t i = 1; i < n; i++) {
+    const uint64_t r = axon_crng_at(&stream, i);
+    swaps[i] = (uint32_t)((r * (uint64_t)(i + 1)) >> 32);
+  }
+
+  uint32_t* AXON_RESTRICT order = self->order;
+  for (size_t i = 0; i < n; i++) {
+    order[i] = (uint32_t)i;
+  }
+
+  for (size_t i = n; i > 1; i--) {
+    const uint32_t j = swaps[i - 1];
+    const uint32_t tmp = order[i - 1];
+    order[i - 1] = order[j];
+    order[j] = tmp;
+  }
+}
+
+/**
+ * @return Zero on success, non-zero on failure.
+ * */
+inline static int
+axon_sampler_init(axon_sampler_z* self, const axon_dataset_z* dataset, const size_t batch_size, const uint64_t seed)
+{
+  memset(self, 0, sizeof(*self));
+
+  if ((dataset->num_records == 0) || (batch_size == 0)) {
+    return -1;
+  }
+
+  self->num_records = dataset->num_records;
+  self->batch_size = batch_size;
+  self->seed = seed;
+
+  void* batch = NULL;
+  if (posix_memalign(&batch, AXON_BUFFER_ALIGN, batch_size * AXON_GRAD_INPUTS * sizeof(float)) != 0) {
+    return -1;
+  }
+  self->batch = (float*)batch;
+  self->order = (uint32_t*)malloc(self->num_records * sizeof(uint32_t));
+  self->swaps = (uint32_t*)malloc(self->num_records * sizeof(uint32_t));
+  if (!self->order || !self->swaps) {
+    free(self->order);
+    free(self->swaps);
+    free(self->batch);
+    memset(self, 0, sizeof(*self));
+    return -1;
+  }
+
+  axon_sampler_shuffle(self);
+  return 0;
+}
+
+/**
+ * @brief Gathers the next mini-batch into a contiguous buffer.
+ *
+ * @details When an epoch is exhausted, the next one is started with a new permutation. The last batch of an epoch may
+ *          be smaller than the batch size.
+ *
+ * @param batch Set to the gathered records, which stay valid until the next call.
+ *
+ * @return The number of records in the batch.
+ * */
+inline static size_t
+axon_sampler_next(axon_sampler_z* self, const axon_dataset_z* dataset, const float** batch)
+{
+  if (self->position >= self->num_records) {
+    self->position = 0;
+    self->epoch++;
+    axon_sampler_shuffle(self);
+  }
+
+  const size_t remaining = self->num_records - self->position;
+  const size_t count = (remaining < self->batch_size) ? remaining : self->batch_size;
+
+  for (size_t i = 0; i < count; i++) {
+    const float* src = dataset->records + ((size_t)self->order[self->position + i]) * AXON_GRAD_INPUTS;
+    memcpy(self->batch + i * AXON_GRAD_INPUTS, src, AXON_GRAD_INPUTS * sizeof(float));
+  }
+
+  self->position += count;
+  *batch = self->batch;
+  return count;
+}
+
+inline static void
+axon_sampler_destroy(axon_sampler_z* self)
+{
+  free(self->order);
+  free(self->swaps);
+  free(self->batch);
+  memset(self, 0, sizeof(*self));
+}
+
+#endif /* AXON_DATASET */
+)";
+
+const char pipelineSrc[] = R"(/* Input Pipeline */
+
+#ifdef AXON_THREADS
+
+#include <sched.h>
+
+#ifndef AXON_PIPELINE_DEPTH
+#define AXON_PIPELINE_DEPTH 3
+#endif
+
+/**
+ * @brief Called on the producer thread to prepare the next mini-batch.
+ *
+ * @param batch Where to write the records, each of AXON_GRAD_INPUTS floats.
+ *
+ * @param capacity The maximum number of records to write.
+ *
+ * @return The number of records that were written. Returning zero ends the pipeline.
+ * */
+typedef size_t (*axon_batch_fn)(void* user, float* batch, size_t capacity);
+
+/**
+ * @brief Prepares mini-batches on a producer thread while the consumer computes gradients.
+ *
+ * @details The batches are handed over through a single-producer, single-consumer ring of AXON_PIPELINE_DEPTH
+ *          buffers. The producer only writes the tail and the consumer only writes the head, so no locks are needed.
+ *          Each index lives on its own cache line.
+ * */
+struct axon_pipeline
+{
+  size_t head;
+
+  char head_padding[AXON_BUFFER_ALIGN - sizeof(size_t)];
+
+  size_t tail;
+
+  char tail_padding[AXON_BUFFER_ALIGN - sizeof(size_t)];
+
+  int stop;
+
+  /* Only used by the consumer. Set once it has acquired the empty batch that ends the pipeline. */
+  int done;
+
+  size_t batch_size;
+
+  size_t counts[AXON_PIPELINE_DEPTH];
+
+  float* buffers;
+
+  axon_batch_fn fill;
+
+  void* user;
+
+  pthread_t thread;
+};
+
+typedef struct axon_pipeline axon_pipeline_z;
+
+inline static float*
+axon_pipeline_buffer(axon_pipeline_z* self, const size_t index)
+{
+  return self->buffers + (index % AXON_PIPELINE_DEPTH) * self->batch_size * AXON_GRAD_INPUTS;
+}
+
+inline static void*
+axon_pipeline_main(void* arg)
+{
+  axon_pipeline_z* self = (axon_pipeline_z*)arg;
+
+  for (;;) {
+
+    const size_t tail = self->tail;
+
+    while ((tail - __atomic_load_n(&self->head, __ATOMIC_ACQUIRE)) == AXON_PIPELINE_DEPTH) {
+      if (__atomic_load_n(&self->stop, __ATOMIC_RELAXED)) {
+        return NULL;
+      }
+      sched_yield();
+    }
+
+    if (__atomic_load_n(&self->stop, __ATOMIC_RELAXED)) {
+      return NULL;
+    }
+
+    const size_t count = self->fill(self->user, axon_pipeline_buffer(self, tail), self->batch_size);
+
+    self->counts[tail % AXON_PIPELINE_DEPTH] = count;
+
+    __atomic_store_n(&self->tail, tail + 1, __ATOMIC_RELEASE);
+
+    if (count == 0) {
+      return NULL;
+    }
+  }
+}
+
+/**
+ * @brief Allocates the ring buffers and starts the producer thread.
+ *
+ * @return Zero on success, non-zero on failure.
+ * */
+inline static int
+axon_pipeline_init(axon_pipeline_z* self, const size_t batch_size, axon_batch_fn fill, void* user)
+{
+  self->head = 0;
+  self->tail = 0;
+  self->stop = 0;
+  self->done = 0;
+  self->batch_size = batch_size;
+  self->fill = fill;
+  self->user = user;
+
+  void* buffers = NULL;
+  const size_t size = AXON_PIPELINE_DEPTH * batch_size * AXON_GRAD_INPUTS * sizeof(float);
+  if ((batch_size == 0) || (posix_memalign(&buffers, AXON_BUFFER_ALIGN, size) != 0)) {
+    return -1;
+  }
+  self->buffers = (float*)buffers;
+
+  if (pthread_create(&self->thread, NULL, axon_pipeline_main, self) != 0) {
+    free(self->buffers);
+    self->buffers = NULL;
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Waits for the next mini-batch.
+ *
+ * @param batch Set to the records of the batch. They stay valid until axon_pipeline_release is called.
+ *
+ * @return The number of records in the batch, or zero if the producer has no more data. Once it has returned zero,
+ *         it returns zero right away on every later call.
+ * */
+inline static size_t
+axon_pipeline_acquire(axon_pipeline_z* self, const float** batch)
+{
+  /* The producer has returned, so no more batches would arrive. */
+  if (self->done) {
+    *batch = NULL;
+    return 0;
+  }
+
+  const size_t head = self->head;
+
+  while (__atomic_load_n(&self->tail, __ATOMIC_ACQUIRE) == head) {
+    sched_yield();
+  }
+
+  *batch = axon_pipeline_buffer(self, head);
+
+  const size_t count = self->counts[head % AXON_PIPELINE_DEPTH];
+
+  self->done = (count == 0);
+
+  return count;
+}
+
+/**
+ * @brief Returns the buffer of the current batch to the producer.
+ * */
+inline static void
+axon_pipeline_release(axon_pipeline_z* self)
+{
+  __atomic_store_n(&self->head, self->head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Stops the producer thread and frees the buffers.
+ * */
+inline static void
+axon_pipeline_destroy(axon_pipeline_z* self)
+{
+  __atomic_store_n(&self->stop, 1, __ATOMIC_RELAXED);
+
+  pthread_join(self->thread, NULL);
+
+  free(self->buffers);
+  self->buffers = NULL;
+}
+
+#endif /* AXON_THREADS */
+)";
+
+class ParamNameWriter final : public ExprVisitor
+{
+public:
+  explicit ParamNameWriter(std::ostream* output)
+    : m_output(output)
+  {
+  }
+
+  void visit(const InputExpr&) override {}
+
+  void visit(const ParamExpr& e) override
+  {
+    const auto name = e.name();
+
+    if (!name.empty()) {
+      (*m_output) << "#define AXON_PARAMETER_" << name << ' ' << e.index() << std::endl;
+      m_names.emplace_back(std::string(name), e.index());
+    }
+  }
+
+  void visit(const ConstExpr&) override {}
+
+  void visit(const NegateExpr&) override {}
+
+  void visit(const RcpExpr&) override {}
+
+  void visit(const SqrtExpr&) override {}
+
+  void visit(const ExpExpr&) override {}
+
+  void visit(const ReLUExpr&) override {}
+
+  void visit(const SigmoidExpr&) override {}
+
+  void visit(const HeavisideExpr&) override {}
+
+  void visit(const SinExpr&) override {}
+
+  void visit(const CosExpr&) override {}
+
+  void visit(const CheckpointExpr&) override {}
+
+  void visit(const AddExpr&) override {}
+
+  void visit(const SubExpr&) override {}
+
+  void visit(const MulExpr&) override {}
+
+  void visit(const OutputExpr&) override {}
+
+  [[nodiscard]] auto numNames() const -> size_t { return m_names.size(); }
+
+  [[nodiscard]] auto names() const -> const std::vector<std::pair<std::string, uint32_t>>& { return m_names; }
+
+private:
+  std::ostream* m_output;
+
+  std::vector<std::pair<std::string, uint32_t>> m_names;
+};
+
+/* Collects the inputs of each input group, in the order that the groups and inputs were declared.
+ * */
+class InputGroupCollector final : public ExprVisitor
+{
+public:
+  void visit(const InputExpr& e) override
+  {
+    const auto group = e.group();
+    if (!group.empty()) {
+      auto it = std::find_if(m_groups.begin(), m_groups.end(), [&group](const auto& g) { return g.first == group; });
+      if (it == m_groups.end()) {
+        it = m_groups.emplace(m_groups.end(), std::string(group), std::vector<uint32_t>());
+      }
+      it->second.emplace_back(m_counter);
+    }
+    m_counter++;
+  }
+
+  void visit(const ParamExpr&) override { m_counter++; }
+
+  void visit(const ConstExpr&) override { m_counter++; }
+
+  void visit(const NegateExpr&) override { m_counter++; }
+
+  void visit(const RcpExpr&) override { m_counter++; }
+
+  void visit(const SqrtExpr&) override { m_counter++; }
+
+  void visit(const ExpExpr&) override { m_counter++; }
+
+  void visit(const ReLUExpr&) override { m_counter++; }
+
+  void visit(const SigmoidExpr&) override { m_counter++; }
+
+  void visit(const HeavisideExpr&) override { m_counter++; }
+
+  void visit(const SinExpr&) override { m_counter++; }
+
+  void visit(const CosExpr&) override { m_counter++; }
+
+  void visit(const CheckpointExpr&) override { m_counter++; }
+
+  void visit(const AddExpr&) override { m_counter++; }
+
+  void visit(const SubExpr&) override { m_counter++; }
+
+  void visit(const MulExpr&) override { m_counter++; }
+
+  void visit(const OutputExpr&) override { m_counter++; }
+
+  [[nodiscard]] auto groups() const -> const std::vector<std::pair<std::string, std::vector<uint32_t>>>&
+  {
+    return m_groups;
+  }
+
+private:
+  uint32_t m_counter{};
+
+  std::vector<std::pair<std::string, std::vector<uint32_t>>> m_groups;
+};
+
+/* Computes a hash of everything that the generated code depends on, other than the exporter itself: the modules, the
+ * extra information that the compiler keeps about them and the options.
+ * */
+class ContentHasher final
+{
+public:
+  [[nodiscard]] auto hash() const -> uint64_t { return m_hash; }
+
+  void add(const uint64_t value)
+  {
+    for (int i = 0; i < 8; i++) {
+      addByte(static_cast<uint8_t>((value >> (i * 8)) & 0xffU));
+    }
+  }
+
+  void add(const std::string_view& s)
+  {
+    add(static_cast<uint64_t>(s.size()));
+    for (const auto c : s) {
+      addByte(static_cast<uint8_t>(c));
+    }
+  }
+
+  void add(const std::vector<Value>& values)
+  {
+    add(static_cast<uint64_t>(values.size()));
+    for (const auto& value : values) {
+      add(value.index());
+    }
+  }
+
+  /* The module hash does not cover input groups and frozen parameters, since they do not change the parameter layout
+   * that it is meant to identify. They do change the generated code, though.
+   * */
+  void add(const Module* module)
+  {
+    if (module == nullptr) {
+      add(uint64_t{ 0 });
+      return;
+    }
+    add(uint64_t{ 1 });
+    add(hashModule(*module));
+    InputGroupCollector inputGroups;
+    module->visit(inputGroups);
+    for (const auto& [name, inputs] : inputGroups.groups()) {
+      add(name);
+      add(static_cast<uint64_t>(inputs.size()));
+      for (const auto input : inputs) {
+        add(input);
+      }
+    }
+    for (const auto& node : analyzeModule(*module)) {
+      if ((node.kind == ExprNode::Kind::param) && node.frozen) {
+        add(node.index);
+      }
+    }
+  }
+
+protected:
+  void addByte(const uint8_t byte)
+  {
+    m_hash ^= byte;
+    m_hash *= 0x100000001b3ULL;
+  }
+
+private:
+  uint64_t m_hash{ 0xcbf29ce484222325ULL };
+};
+
+/* Rewrites the dot products that matmul and linear scalarize into chains of multiply-adds as loops over contiguous
+ * ranges of the parameters. Each row of a matrix product becomes a chain like this one:
+ *
+ *   sum = c + parameters[b] * x[0] + parameters[b + s] * x[1] + ...
+ *
+ * Chains with the same vector x, the same parameter stride s and the same constant c, whose offsets b are evenly
+ * spaced, are the rows of one product. They are emitted as a single loop over x, which is gathered into an array
+ * first, around a loop over the rows. The rows are independent, so the inner loop can be vectorized, and each row
+ * still adds its terms in the same order as before, so the results do not change. Only the chains whose products and
+ * partial sums are not used anywhere else are rewritten.
+ * */
+class LoopReroller final
+{
+public:
+  using Statement = CStatement;
+
+  using Op = CStatement::Op;
+
+  /* The fewest terms that a chain needs to be worth a loop. */
+  static constexpr size_t minTerms = 8;
+
+  explicit LoopReroller(const std::vector<Statement>& statements)
+    : m_statements(statements)
+  {
+    for (size_t i = 0; i < statements.size(); i++) {
+      for (const auto value : statements[i].values) {
+        m_definitions.emplace(value, i);
+      }
+      for (const auto op : statements[i].operands) {
+        m_uses[op]++;
+      }
+    }
+  }
+
+  [[nodiscard]] auto reroll() const -> std::vector<Statement>
+  {
+    const auto n = m_statements.size();
+
+    // Chains are searched for from the end, so that the partial sums of a chain are not taken for chains of their own.
+    std::vector<Chain> chains;
+    std::vector<bool> claimed(n, false);
+    for (auto i = n; i-- > 0;) {
+      if (claimed[i]) {
+        continue;
+      }
+      auto chain = findChain(i);
+      if (chain.params.size() < minTerms) {
+        continue;
+      }
+      for (const auto j : chain.interior) {
+        claimed[j] = true;
+      }
+      chains.emplace_back(std::move(chain));
+    }
+
+    if (chains.empty()) {
+      return m_statements;
+    }
+
+    std::reverse(chains.begin(), chains.end());
+
+    // The groups of rows, and the last group with each combination of x, stride, constant and length.
+    std::vector<std::vector<const Chain*>> groups;
+    std::map<std::tuple<std::vector<uint32_t>, uint32_t, std::string, size_t>, size_t> lastGroup;
+    for (const auto& chain : chains) {
+      const auto key = std::make_tuple(chain.xs, chain.stride, chain.start, chain.params.size());
+      const auto last = lastGroup.find(key);
+      if (chain.constantStart && (last != lastGroup.end())) {
+        auto& rows = groups[last->second];
+        const auto first = rows[0]->params[0];
+        const auto rowStride = (rows.size() > 1) ? (rows[1]->params[0] - first) : (chain.params[0] - first);
+        if ((chain.params[0] > first) && (chain.params[0] == first + rows.size() * rowStride)) {
+          rows.emplace_back(&chain);
+          continue;
+        }
+      }
+      lastGroup[key] = groups.size();
+      groups.push_back({ &chain });
+    }
+
+    std::set<size_t> removed;
+    std::map<size_t, Statement> replacements;
+    for (const auto& rows : groups) {
+      for (const auto* row : rows) {
+        removed.insert(row->interior.begin(), row->interior.end());
+      }
+      replacements.emplace(rows[0]->end, loop(rows));
+    }
+
+    std::vector<Statement> result;
+    for (size_t i = 0; i < n; i++) {
+      if (const auto replacement = replacements.find(i); replacement != replacements.end()) {
+        result.emplace_back(replacement->second);
+      } else if (removed.count(i) == 0) {
+        result.emplace_back(m_statements[i]);
+      }
+    }
+
+    // The parameters are now read by the loops, so the statements that loaded them may no longer be needed.
+    std::map<uint32_t, uint32_t> uses;
+    for (const auto& statement : result) {
+      for (const auto op : statement.operands) {
+        uses[op]++;
+      }
+    }
+    result.erase(std::remove_if(result.begin(),
+                                result.end(),
+                                [&](const Statement& s) {
+                                  return (s.op == Op::param) && s.stores.empty() && (uses[s.values[0]] == 0) &&
+                                         (m_uses.count(s.values[0]) != 0);
+                                }),
+                 result.end());
+
+    return result;
+  }
+
+protected:
+  struct Chain final
+  {
+    /* The statement that computes the sum. */
+    size_t end{};
+
+    std::vector<uint32_t> params;
+
+    std::vector<uint32_t> xs;
+
+    uint32_t stride{};
+
+    /* The initial value of the sum, when it is a constant. */
+    std::string start;
+
+    bool constantStart{ false };
+
+    /* The initial value of the sum, when it is not a constant. */
+    uint32_t startValue{};
+
+    /* The statements that the loop replaces. */
+    std::vector<size_t> interior;
+  };
+
+  [[nodiscard]] auto uses(const uint32_t value) const -> uint32_t
+  {
+    const auto it = m_uses.find(value);
+    return (it == m_uses.end()) ? 0 : it->second;
+  }
+
+  [[nodiscard]] auto definition(const uint32_t value) const -> const Statement&
+  {
+    return m_statements[m_definitions.at(value)];
+  }
+
+  /* Finds the product of a parameter and another value that an addition adds to its other operand, which is then
+   * the partial sum. Returns false if neither operand is such a product.
+   * */
+  [[nodiscard]] auto findTerm(const Statement& add, uint32_t* mul, uint32_t* partialSum) const -> bool
+  {
+    for (int i = 1; i >= 0; i--) {
+      const auto value = add.operands[static_cast<size_t>(i)];
+      const auto& s = definition(value);
+      if ((s.op != Op::mul) || !s.stores.empty() || (uses(value) != 1)) {
+        continue;
+      }
+      if ((definition(s.operands[0]).op == Op::param) || (definition(s.operands[1]).op == Op::param)) {
+        *mul = value;
+        *partialSum = add.operands[static_cast<size_t>(1 - i)];
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /* Returns the chain that ends with the given statement, or a chain without terms if there is none. */
+  [[nodiscard]] auto findChain(const size_t end) const -> Chain
+  {
+    Chain chain;
+    chain.end = end;
+
+    auto cur = end;
+    uint32_t mul{};
+    uint32_t partialSum{};
+    if ((m_statements[end].op != Op::add) || !findTerm(m_statements[end], &mul, &partialSum)) {
+      return {};
+    }
+
+    while (true) {
+      const auto& product = definition(mul);
+      const auto paramFirst = (definition(product.operands[0]).op == Op::param);
+      chain.params.emplace_back(definition(product.operands[paramFirst ? 0 : 1]).access.index);
+      chain.xs.emplace_back(product.operands[paramFirst ? 1 : 0]);
+      chain.interior.emplace_back(cur);
+      chain.interior.emplace_back(m_definitions.at(mul));
+
+      const auto next = m_definitions.at(partialSum);
+      const auto& s = m_statements[next];
+      if ((s.op == Op::add) && s.stores.empty() && (uses(partialSum) == 1) && findTerm(s, &mul, &partialSum)) {
+        cur = next;
+        continue;
+      }
+
+      if (s.op == Op::constant) {
+        chain.start = s.constant;
+        chain.constantStart = true;
+        if (s.stores.empty() && (uses(partialSum) == 1)) {
+          chain.interior.emplace_back(next);
+        }
+      } else {
+        chain.startValue = partialSum;
+      }
+      break;
+    }
+
+    std::reverse(chain.params.begin(), chain.params.end());
+    std::reverse(chain.xs.begin(), chain.xs.end());
+
+    chain.stride = (chain.params.size() > 1) ? (chain.params[1] - chain.params[0]) : 1;
+    for (size_t k = 0; k < chain.params.size(); k++) {
+      if ((chain.stride == 0) || (chain.params[k] < chain.params[0]) ||
+          (chain.params[k] != chain.params[0] + k * chain.stride)) {
+        return {};
+      }
+    }
+
+    return chain;
+  }
+
+  /* Emits the rows of a product as one statement, which defines the sum of every row. */
+  [[nodiscard]] auto loop(const std::vector<const Chain*>& rows) const -> Statement
+  {
+    const auto& first = *rows[0];
+
+    Statement statement;
+    statement.op = Op::loop;
+    statement.operands = first.xs;
+    if (first.constantStart) {
+      statement.constant = first.start;
+    } else {
+      statement.operands.emplace_back(first.startValue);
+    }
+    statement.access = { "parameters", first.params[0] };
+    statement.loop.rows = static_cast<uint32_t>(rows.size());
+    statement.loop.rowStride = (rows.size() > 1) ? (rows[1]->params[0] - first.params[0]) : 0;
+    statement.loop.stride = first.stride;
+
+    for (const auto* row : rows) {
+      const auto& end = m_statements[row->end];
+      statement.values.emplace_back(end.values[0]);
+      statement.stores.insert(statement.stores.end(), end.stores.begin(), end.stores.end());
+    }
+
+    return statement;
+  }
+
+private:
+  const std::vector<Statement>& m_statements;
+
+  std::map<uint32_t, size_t> m_definitions;
+
+  std::map<uint32_t, uint32_t> m_uses;
+};
+
+/* Defines the generated functions, either in the header or in separate source files.
+ *
+ * Without source files, each function is defined in the header as an inline static function. With source files, the
+ * header only declares the function and the definition goes to the source file with the fewest statements so far.
+ * Bodies with more statements than the chunk size are split into parts, each in the least loaded source file, which
+ * the function calls in order. Values that a later part needs are passed through a buffer on the stack of the
+ * function, so the parts are cut where the fewest values are live. Statements that only read the arguments, such as
+ * inputs, parameters and constants, are repeated by each part that needs them instead.
+ *
+ * The blocks that repeated subgraphs are moved to are defined as static functions next to the function that calls
+ * them. For a function that is split into parts, they are defined once and declared in every file with a part.
+ * */
+class CFunctionSink final
+{
+public:
+  /**
+   * @param reroll Whether to rewrite matrix products as loops, with LoopReroller.
+   *
+   * @param outline Whether to move repeated subgraphs to blocks, with SubgraphOutliner.
+   * */
+  CFunctionSink(const uint32_t numSources, const uint32_t chunkSize, const bool reroll, const bool outline)
+    : m_sources(numSources)
+    , m_chunkSize(std::max<uint32_t>(chunkSize, 1))
+    , m_reroll(reroll)
+    , m_outline(outline)
+  {
+  }
+
+  /**
+   * @brief Writes a function to the header, and to the source files if there are any.
+   *
+   * @param params The declarations of the parameters, which are all pointers or values named after their last word.
+   * */
+  void define(std::ostream& header,
+              const std::string& name,
+              const std::vector<std::string>& params,
+              const CExprWriter& writer)
+  {
+    const auto used = removeUnused(writer.statements());
+    const auto rerolled = m_reroll ? LoopReroller(used).reroll() : used;
+    SubgraphOutliner outliner(rerolled, name, params);
+    const auto statements = m_outline ? outliner.outline() : rerolled;
+    const auto& blocks = outliner.blocks();
+
+    if (m_sources.empty()) {
+      for (const auto& block : blocks) {
+        header << "inline static void" << std::endl;
+        header << signature(block.name, block.params) << std::endl;
+        header << "{" << std::endl;
+        header << block.body;
+        header << '}' << std::endl;
+        header << std::endl;
+      }
+      header << "inline static void" << std::endl;
+      header << signature(name, params) << std::endl;
+      header << "{" << std::endl;
+      header << unusedCasts(params, usedArguments(statements));
+      header << formatStatements(statements);
+      header << '}' << std::endl;
+      header << std::endl;
+      return;
+    }
+
+    header << "AXON_EXTERN void" << std::endl;
+    header << signature(name, params) << ';' << std::endl;
+    header << std::endl;
+
+    if (statements.size() <= m_chunkSize) {
+      auto& source = leastLoaded();
+      for (const auto& block : blocks) {
+        source.definitions << "static void\n" << signature(block.name, block.params) << "\n{\n";
+        source.definitions << block.body << "}\n\n";
+      }
+      source.definitions << "void\n" << signature(name, params) << "\n{\n";
+      source.definitions << unusedCasts(params, usedArguments(statements)) << formatStatements(statements) << "}\n\n";
+      source.statements += statements.size();
+      return;
+    }
+
+    defineParts(name, params, statements, blocks);
+  }
+
+  /**
+   * @brief Returns the contents of the source files, which include the header with the given name.
+   * */
+  [[nodiscard]] auto sources(const std::string& headerName) const -> std::vector<std::string>
+  {
+    std::vector<std::string> contents;
+    for (const auto& source : m_sources) {
+      std::ostringstream f;
+      f << "/* Note: This file is automatically generated. Edits may be lost. */" << std::endl;
+      f << std::endl;
+      f << "#include " << std::quoted(headerName) << std::endl;
+      f << std::endl;
+      f << source.prototypes.str();
+      f << source.definitions.str();
+      contents.emplace_back(f.str());
+    }
+    return contents;
+  }
+
+protected:
+  using Statement = CStatement;
+
+  struct Source final
+  {
+    std::ostringstream prototypes;
+
+    std::ostringstream definitions;
+
+    size_t statements{};
+  };
+
+  [[nodiscard]] static auto signature(const std::string& name, const std::vector<std::string>& params) -> std::string
+  {
+    if (params.empty()) {
+      return name + "(void)";
+    }
+    std::string s = name + "(";
+    for (size_t i = 0; i < params.size(); i++) {
+      if (i > 0) {
+        s += ",\n" + std::string(name.size() + 1, ' ');
+      }
+      s += params[i];
+    }
+    return s + ")";
+  }
+
+  /* Removes the statements whose values are neither used nor stored, such as the values of a network that do not
+   * reach the outputs of the function. */
+  [[nodiscard]] static auto removeUnused(const std::vector<Statement>& statements) -> std::vector<Statement>
+  {
+    std::set<uint32_t> used;
+    std::vector<bool> keep(statements.size(), false);
+    for (auto i = statements.size(); i-- > 0;) {
+      const auto& s = statements[i];
+      keep[i] = s.values.empty() || !s.stores.empty() ||
+                std::any_of(s.values.begin(), s.values.end(), [&used](const uint32_t v) { return used.count(v) != 0; });
+      if (keep[i]) {
+        used.insert(s.operands.begin(), s.operands.end());
+      }
+    }
+
+    std::vector<Statement> result;
+    for (size_t i = 0; i < statements.size(); i++) {
+      if (keep[i]) {
+        result.emplace_back(statements[i]);
+      }
+    }
+    return result;
+  }
+
+  [[nodiscard]] static auto usedArguments(const std::vector<Statement>& statements) -> std::set<std::string>
+  {
+    std::set<std::string> used;
+    for (const auto& statement : statements) {
+      used.merge(statementArguments(statement));
+    }
+    return used;
+  }
+
+  /* Returns casts to void for the parameters that are not used, so that compilers do not warn about them. This happens
+   * when a function has nothing to compute, such as axon_prepare for a network without values that only depend on the
+   * parameters. */
+  [[nodiscard]] static auto unusedCasts(const std::vector<std::string>& params, const std::set<std::string>& used)
+    -> std::string
+  {
+    std::string casts;
+    for (const auto& param : params) {
+      const auto arg = argumentName(param);
+      if (used.count(arg) == 0) {
+        casts += "  (void)" + arg + ";\n";
+      }
+    }
+    return casts;
+  }
+
+  [[nodiscard]] auto leastLoaded() -> Source&
+  {
+    return *std::min_element(m_sources.begin(), m_sources.end(), [](const Source& a, const Source& b) {
+      return a.statements < b.statements;
+    });
+  }
+
+  /* Returns the positions at which the statements are cut into parts. The first one is zero and the last one is the
+   * number of statements. Each cut is searched for near the point that makes the parts equally long.
+   *
+   * The lifetimes are the statement that defines each value that may be passed between parts, and its last use.
+   * */
+  [[nodiscard]] auto findCuts(const size_t n, const std::vector<std::pair<size_t, size_t>>& lifetimes) const
+    -> std::vector<size_t>
+  {
+    // The number of values that are live across the point before each statement.
+    std::vector<int64_t> live(n + 1, 0);
+    for (const auto& [def, last] : lifetimes) {
+      live[def + 1]++;
+      live[last + 1]--;
+    }
+    for (size_t i = 1; i <= n; i++) {
+      live[i] += live[i - 1];
+    }
+
+    const auto numParts = (n + m_chunkSize - 1) / m_chunkSize;
+    const auto window = n / (4 * numParts);
+
+    std::vector<size_t> cuts{ 0 };
+    for (size_t k = 1; k < numParts; k++) {
+      const auto target = (k * n) / numParts;
+      auto best = target;
+      for (auto i = std::max(target - window, cuts.back() + 1); i <= std::min(target + window, n - 1); i++) {
+        const auto distance = [target](const size_t j) { return (j > target) ? (j - target) : (target - j); };
+        if ((live[i] < live[best]) || ((live[i] == live[best]) && (distance(i) < distance(best)))) {
+          best = i;
+        }
+      }
+      cuts.emplace_back(best);
+    }
+    cuts.emplace_back(n);
+    return cuts;
+  }
+
+  void defineParts(const std::string& name,
+                   const std::vector<std::string>& params,
+                   const std::vector<Statement>& s,
+                   const std::vector<SubgraphOutliner::Block>& blocks)
+  {
+    const auto n = s.size();
+
+    // The blocks may be called from any part, so they are declared in every source file with a part.
+    std::ostringstream blockPrototypes;
+    if (!blocks.empty()) {
+      auto& source = leastLoaded();
+      for (const auto& block : blocks) {
+        const auto blockSignature = signature(block.name, block.params);
+        source.definitions << "void\n" << blockSignature << "\n{\n" << block.body << "}\n\n";
+        blockPrototypes << "void\n" << blockSignature << ";\n\n";
+      }
+    }
+    std::set<const Source*> declared;
+
+    std::map<uint32_t, size_t> definitions;
+    for (size_t i = 0; i < n; i++) {
+      for (const auto value : s[i].values) {
+        definitions.emplace(value, i);
+      }
+    }
+
+    // Statements without operands only read the arguments, so they are repeated instead of passed between parts.
+    const auto repeatable = [&s](const size_t i) { return (s[i].values.size() == 1) && s[i].operands.empty(); };
+
+    std::map<uint32_t, size_t> lastUse;
+    for (size_t i = 0; i < n; i++) {
+      for (const auto op : s[i].operands) {
+        if (!repeatable(definitions.at(op))) {
+          lastUse[op] = std::max(lastUse[op], i);
+        }
+      }
+    }
+
+    std::vector<std::pair<size_t, size_t>> lifetimes;
+    for (const auto& [value, last] : lastUse) {
+      lifetimes.emplace_back(definitions.at(value), last);
+    }
+
+    const auto cuts = findCuts(n, lifetimes);
+    const auto numParts = cuts.size() - 1;
+
+    std::vector<size_t> part(n);
+    for (size_t p = 0; p < numParts; p++) {
+      for (auto i = cuts[p]; i < cuts[p + 1]; i++) {
+        part[i] = p;
+      }
+    }
+
+    // A value takes a slot of the buffer from the end of the part that defines it to the start of the last part that
+    // uses it, which reads all of its values before writing any, so the slot can be reused from there on.
+    std::map<uint32_t, size_t> slots;
+    std::vector<size_t> freeSlots;
+    size_t numSlots{};
+    for (size_t p = 0; p < numParts; p++) {
+      for (const auto& [value, slot] : slots) {
+        if (part[lastUse.at(value)] == p) {
+          freeSlots.emplace_back(slot);
+        }
+      }
+      for (auto i = cuts[p]; i < cuts[p + 1]; i++) {
+        for (const auto value : s[i].values) {
+          const auto last = lastUse.find(value);
+          if ((last == lastUse.end()) || (part[last->second] == p)) {
+            continue;
+          }
+          if (freeSlots.empty()) {
+            freeSlots.emplace_back(numSlots++);
+          }
+          slots.emplace(value, freeSlots.back());
+          freeSlots.pop_back();
+        }
+      }
+    }
+
+    std::ostringstream body;
+    if (numSlots > 0) {
+      body << "  float live[" << numSlots << "];\n";
+    }
+
+    std::ostringstream prototypes;
+
+    // The arguments that any part uses, so that the function can cast the others to void.
+    std::set<std::string> used;
+
+    for (size_t p = 0; p < numParts; p++) {
+      const auto partName = name + "_part" + std::to_string(p);
+
+      std::set<uint32_t> read;
+      for (auto i = cuts[p]; i < cuts[p + 1]; i++) {
+        read.insert(s[i].operands.begin(), s[i].operands.end());
+      }
+
+      // The values from earlier parts, in the order of their definitions.
+      std::set<std::pair<size_t, uint32_t>> earlier;
+      for (const auto value : read) {
+        if (const auto def = definitions.at(value); def < cuts[p]) {
+          earlier.emplace(def, value);
+        }
+      }
+
+      std::set<std::string> arguments;
+      std::ostringstream code;
+      for (const auto& [def, value] : earlier) {
+        if (repeatable(def)) {
+          auto leaf = s[def];
+          leaf.stores.clear();
+          code << "  " << formatStatement(leaf) << '\n';
+          arguments.merge(statementArguments(leaf));
+        } else {
+          code << "  const float v" << value << " = live[" << slots.at(value) << "];\n";
+          arguments.emplace("live");
+        }
+      }
+      for (auto i = cuts[p]; i < cuts[p + 1]; i++) {
+        if (repeatable(i) && s[i].stores.empty() && (read.count(s[i].values[0]) == 0)) {
+          continue;
+        }
+        code << "  " << formatStatement(s[i]) << '\n';
+        arguments.merge(statementArguments(s[i]));
+        for (const auto value : s[i].values) {
+          if (const auto slot = slots.find(value); slot != slots.end()) {
+            code << "  live[" << slot->second << "] = v" << value << ";\n";
+            arguments.emplace("live");
+          }
+        }
+      }
+
+      // Parts that only define values which are repeated where they are needed have nothing to do.
+      if (code.tellp() == 0) {
+        continue;
+      }
+
+      // Each part only takes the arguments that it uses.
+      std::vector<std::string> partParams;
+      for (const auto& param : params) {
+        if (arguments.count(argumentName(param)) != 0) {
+          partParams.emplace_back(param);
+        }
+      }
+      if (arguments.count("live") != 0) {
+        partParams.emplace_back("float* AXON_RESTRICT live");
+      }
+      used.merge(arguments);
+
+      const auto partSignature = signature(partName, partParams);
+
+      auto& source = leastLoaded();
+      if (declared.emplace(&source).second) {
+        source.prototypes << blockPrototypes.str();
+      }
+      source.definitions << "void\n" << partSignature << "\n{\n" << code.str() << "}\n\n";
+      source.statements += cuts[p + 1] - cuts[p];
+
+      prototypes << "void\n" << partSignature << ";\n\n";
+
+      body << "  " << partName << "(";
+      for (size_t k = 0; k < partParams.size(); k++) {
+        body << ((k > 0) ? ", " : "") << argumentName(partParams[k]);
+      }
+      body << ");\n";
+    }
+
+    body << "}\n\n";
+
+    auto& source = leastLoaded();
+    source.prototypes << prototypes.str();
+    source.definitions << "void\n" << signature(name, params) << "\n{\n" << unusedCasts(params, used) << body.str();
+  }
+
+private:
+  std::vector<Source> m_sources;
+
+  uint32_t m_chunkSize{};
+
+  bool m_reroll{ true };
+
+  bool m_outline{ true };
+};
+
+class CExporter final : public Exporter
+{
+public:
+  void exportFull(const Compiler& compiler, const Compiler::Options& options) override
+  {
+    const auto& evalModule = *compiler.getEvalModule();
+    const auto& gradModule = *compiler.getGradModule();
+
+    const auto contentHash = hashContent(compiler, options);
+
+    CFunctionSink functions(options.sourceFiles, options.chunkSize, options.reroll, options.outline);
+
+    // The header is generated in memory and only written when it changed, so that everything that includes it is not
+    // recompiled when the generator is rebuilt without changing the network.
+    std::ostringstream f;
+    f << "#pragma once" << std::endl;
+    f << std::endl;
+    f << "/* Note: This file is automatically generated. Edits may be lost. */" << std::endl;
+    f << std::endl;
+    f << "#include <stddef.h>" << std::endl;
+    f << "#include <stdint.h>" << std::endl;
+    f << "#include <math.h>" << std::endl;
+    f << "#include <limits.h>" << std::endl;
     f << std::endl;
     f << macrosSrc;
     f << std::endl;
@@ -380,41 +3077,1012 @@ public:
     f << "#define AXON_EVAL_INPUTS " << evalModule.numInputs() << std::endl;
     f << "#define AXON_EVAL_OUTPUTS " << evalModule.numOutputs() << std::endl;
     f << std::endl;
-    f << "#define AXON_GRAD_INPUTS " << gradModule.numInputs() << std::endl;
-    f << "#define AXON_GRAD_OUTPUTS " << gradModule.numOutputs() << std::endl;
+    f << "#define AXON_GRAD_INPUTS " << lossWeightsBegin(compiler) << std::endl;
+    f << "#define AXON_GRAD_OUTPUTS " << gradModule.numParameters() << std::endl;
+    f << "#define AXON_GRAD_LOSSES " << compiler.getGradLosses() << std::endl;
+    f << std::endl;
+    f << "/* The number of values written to the aux buffer by axon_grad_aux: the losses, then the extra outputs. */"
+      << std::endl;
+    f << "#define AXON_GRAD_AUX_OUTPUTS " << (gradModule.numOutputs() - gradModule.numParameters()) << std::endl;
+    f << std::endl;
+    f << "/* The largest number of intermediate values that axon_grad keeps live at once, in evaluation order. */"
+      << std::endl;
+    f << "#define AXON_GRAD_PEAK_VALUES " << peakLiveValues(analyzeModule(gradModule)) << std::endl;
+    f << std::endl;
+    f << "#define AXON_GRAPH_HASH 0x" << std::hex << hashModule(evalModule) << std::dec << "ULL" << std::endl;
+    f << std::endl;
+    f << "/* A hash of the modules and the compiler options that this file was generated from. */" << std::endl;
+    f << "#define AXON_CONTENT_HASH 0x" << std::hex << contentHash << std::dec << "ULL" << std::endl;
     f << std::endl;
     ParamNameWriter paramNameWriter(&f);
     evalModule.visit(paramNameWriter);
     if (paramNameWriter.numNames() > 0) {
       f << std::endl;
     }
-    f << "inline static void" << std::endl;
-    f << "axon_eval(const float* AXON_RESTRICT parameters, const float* AXON_RESTRICT input, float* AXON_RESTRICT "
-         "output)"
-      << std::endl;
-    f << "{" << std::endl;
     {
       CExprWriter writer;
       evalModule.visit(writer);
-      f << writer.source();
+      functions.define(f,
+                       "axon_eval",
+                       { "const float* AXON_RESTRICT parameters",
+                         "const float* AXON_RESTRICT input",
+                         "float* AXON_RESTRICT output" },
+                       writer);
     }
-    f << '}' << std::endl;
-    f << std::endl;
-    f << "inline static void" << std::endl;
-    f << "axon_grad(const float* AXON_RESTRICT parameters, const float* AXON_RESTRICT input, float* AXON_RESTRICT "
-         "output)"
+    writePrepared(f, functions, evalModule);
+    if (!compiler.getOutputGroups().empty()) {
+      writeOutputGroups(f, functions, evalModule, compiler.getOutputGroups());
+    }
+    if (!compiler.getEvalStages().empty()) {
+      writeStages(f, functions, evalModule, compiler.getEvalStages());
+    }
+    {
+      InputGroupCollector inputGroups;
+      evalModule.visit(inputGroups);
+      if (!inputGroups.groups().empty()) {
+        writeIncremental(f, functions, evalModule, inputGroups.groups());
+      }
+    }
+    {
+      CExprWriter writer;
+      excludeAuxOutputs(writer, gradModule);
+      substituteLossWeights(writer, compiler, "");
+      gradModule.visit(writer);
+      functions.define(f,
+                       "axon_grad",
+                       { "const float* AXON_RESTRICT parameters",
+                         "const float* AXON_RESTRICT input",
+                         "float* AXON_RESTRICT output" },
+                       writer);
+    }
+    f << "/**" << std::endl;
+    f << " * @brief Like axon_grad, but also outputs the loss and the auxiliary values from the same forward pass."
       << std::endl;
-    f << "{" << std::endl;
+    f << " *" << std::endl;
+    f << " * @param aux Receives AXON_GRAD_AUX_OUTPUTS values. The first one is the loss." << std::endl;
+    f << " * */" << std::endl;
     {
       CExprWriter writer;
+      writer.redirectOutputs(gradModule.numParameters(), "aux");
+      substituteLossWeights(writer, compiler, "");
       gradModule.visit(writer);
-      f << writer.source();
+      functions.define(f,
+                       "axon_grad_aux",
+                       { "const float* AXON_RESTRICT parameters",
+                         "const float* AXON_RESTRICT input",
+                         "float* AXON_RESTRICT output",
+                         "float* AXON_RESTRICT aux" },
+                       writer);
+    }
+    f << "/**" << std::endl;
+    f << " * @brief Like axon_grad, but adds (scale * gradient) to the output instead of overwriting it." << std::endl;
+    f << " *" << std::endl;
+    f << " * @details This is used for mini-batch training. Clear the output once per batch, accumulate" << std::endl;
+    f << " *          each sample into it and then run a single optimizer step." << std::endl;
+    f << " * */" << std::endl;
+    {
+      CExprWriter writer(/*accumulate=*/true);
+      excludeAuxOutputs(writer, gradModule);
+      substituteLossWeights(writer, compiler, "");
+      gradModule.visit(writer);
+      functions.define(f,
+                       "axon_grad_accumulate",
+                       { "const float* AXON_RESTRICT parameters",
+                         "const float* AXON_RESTRICT input",
+                         "float* AXON_RESTRICT output",
+                         "const float scale" },
+                       writer);
+    }
+    if (compiler.getGradLosses() > 1) {
+      writeWeighted(f, functions, compiler);
+    }
+    writeTrainable(f, functions, compiler);
+    if (const auto* backwardModule = compiler.getBackwardModule(); backwardModule != nullptr) {
+      writeTape(f, functions, evalModule, *backwardModule);
+    }
+    if (const auto* jvpModule = compiler.getJvpModule(); jvpModule != nullptr) {
+      writeJvp(f, functions, *jvpModule, compiler.getJvpTangents());
+    }
+    if (const auto* hvpModule = compiler.getHvpModule(); hvpModule != nullptr) {
+      writeHvp(f, functions, *hvpModule);
     }
-    f << '}' << std::endl;
-    f << std::endl;
     f << optimizerSrc;
+    f << std::endl;
+    f << threadsSrc;
+    f << std::endl;
+    f << hogwildSrc;
+    f << std::endl;
+    f << shmSrc;
+    f << std::endl;
+    writeParamsFile(f, paramNameWriter, options);
+    f << std::endl;
+    f << datasetSrc;
+    f << std::endl;
+    f << pipelineSrc;
+
+    writeIfChanged(options.outputFile, f.str());
+
+    const std::filesystem::path header(options.outputFile);
+    const auto sources = functions.sources(header.filename().string());
+    for (size_t i = 0; i < sources.size(); i++) {
+      auto path = header;
+      path.replace_filename(header.stem().string() + "_" + std::to_string(i) + ".c");
+      writeIfChanged(path.string(), sources[i]);
+    }
+  }
+
+protected:
+  [[nodiscard]] static auto hashContent(const Compiler& compiler, const Compiler::Options& options) -> uint64_t
+  {
+    ContentHasher hasher;
+    hasher.add(compiler.getEvalModule());
+    hasher.add(compiler.getGradModule());
+    hasher.add(compiler.getBackwardModule());
+    hasher.add(compiler.getJvpModule());
+    hasher.add(compiler.getHvpModule());
+    hasher.add(compiler.getJvpTangents());
+    hasher.add(compiler.getGradLosses());
+    for (const auto& stage : compiler.getEvalStages()) {
+      hasher.add(stage.name);
+      hasher.add(stage.inputs);
+    }
+    for (const auto& group : compiler.getOutputGroups()) {
+      hasher.add(group.name);
+      hasher.add(group.outputs);
+    }
+    hasher.add(options.networkName);
+    hasher.add(options.parametersPath);
+    hasher.add(options.checkpointSegments);
+    hasher.add(options.sourceFiles);
+    hasher.add(options.chunkSize);
+    hasher.add(options.reroll ? 1U : 0U);
+    hasher.add(options.outline ? 1U : 0U);
+    return hasher.hash();
+  }
+
+  /* Writes a file, unless it already has the given contents. Comparing the contents, rather than only the content
+   * hash, also catches changes to the exporter itself.
+   * */
+  static void writeIfChanged(const std::string& path, const std::string& contents)
+  {
+    {
+      std::ifstream existing(path, std::ios::binary);
+      if (existing) {
+        std::ostringstream previous;
+        previous << existing.rdbuf();
+        if (previous.str() == contents) {
+          return;
+        }
+      }
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    file << contents;
+    file.close();
+    if (!file) {
+      throw Exception("failed to write \"" + path + "\"");
+    }
+  }
+
+  /* The grad module outputs the loss and the auxiliary values after the gradients. They are skipped by the entry points
+   * that only write the gradients.
+   * */
+  static void excludeAuxOutputs(CExprWriter& writer, const Module& gradModule)
+  {
+    const auto nodes = analyzeModule(gradModule);
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+      if ((nodes[i].kind == ExprNode::Kind::output) && (nodes[i].index >= gradModule.numParameters())) {
+        writer.exclude(i);
+      }
+    }
+  }
+
+  /* With more than one loss, the weights of the losses are the last inputs of the grad module. */
+  [[nodiscard]] static auto lossWeightsBegin(const Compiler& compiler) -> uint32_t
+  {
+    const auto numInputs = compiler.getGradModule()->numInputs();
+    return (compiler.getGradLosses() > 1) ? (numInputs - compiler.getGradLosses()) : numInputs;
+  }
+
+  /* Reads the weights of the losses from the given array, or uses a weight of one when no array is given. */
+  static void substituteLossWeights(CExprWriter& writer, const Compiler& compiler, const std::string& weights)
+  {
+    const auto begin = lossWeightsBegin(compiler);
+    const auto nodes = analyzeModule(*compiler.getGradModule());
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+      if ((nodes[i].kind == ExprNode::Kind::input) && (nodes[i].index >= begin)) {
+        if (weights.empty()) {
+          writer.substituteConstant(i, "1.0F");
+        } else {
+          writer.substitute(i, { weights, nodes[i].index - begin });
+        }
+      }
+    }
+  }
+
+  /* Emits the entry point that weighs the gradients of the losses at run time. */
+  static void writeWeighted(std::ostream& f, CFunctionSink& functions, const Compiler& compiler)
+  {
+    const auto& gradModule = *compiler.getGradModule();
+
+    CExprWriter writer;
+    excludeAuxOutputs(writer, gradModule);
+    substituteLossWeights(writer, compiler, "weights");
+    gradModule.visit(writer);
+
+    f << "/**" << std::endl;
+    f << " * @brief Computes the weighted sum of the gradients of the losses, sharing one forward pass between them."
+      << std::endl;
+    f << " *" << std::endl;
+    f << " * @details axon_grad is the same as passing a weight of one for every loss. Passing a weight of one for a"
+      << std::endl;
+    f << " *          single loss, and zero for the others, yields the gradient of that loss alone." << std::endl;
+    f << " *" << std::endl;
+    f << " * @param weights The AXON_GRAD_LOSSES weights, in the order that the losses were given to the compiler."
+      << std::endl;
+    f << " * */" << std::endl;
+    functions.define(f,
+                     "axon_grad_weighted",
+                     { "const float* AXON_RESTRICT parameters",
+                       "const float* AXON_RESTRICT input",
+                       "const float* AXON_RESTRICT weights",
+                       "float* AXON_RESTRICT output" },
+                     writer);
+  }
+
+  /* When some parameters are frozen, emits an entry point that only writes the gradients of the trainable parameters
+   * to a compact buffer, along with the index map from that buffer to the parameters.
+   * */
+  static void writeTrainable(std::ostream& f, CFunctionSink& functions, const Compiler& compiler)
+  {
+    const auto& gradModule = *compiler.getGradModule();
+
+    const auto nodes = analyzeModule(gradModule);
+
+    std::vector<uint32_t> trainable;
+    for (const auto& node : nodes) {
+      if ((node.kind == ExprNode::Kind::param) && !node.frozen) {
+        trainable.emplace_back(node.index);
+      }
+    }
+
+    if (trainable.size() == gradModule.numParameters()) {
+      return;
+    }
+
+    std::sort(trainable.begin(), trainable.end());
+
+    std::map<uint32_t, uint32_t> compact;
+    for (uint32_t i = 0; i < trainable.size(); i++) {
+      compact.emplace(trainable[i], i);
+    }
+
+    std::vector<uint32_t> outputs;
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+      if ((nodes[i].kind == ExprNode::Kind::output) && (compact.count(nodes[i].index) != 0)) {
+        outputs.emplace_back(i);
+      }
+    }
+
+    CExprWriter writer;
+    writer.selectOutputs(std::move(compact));
+    substituteLossWeights(writer, compiler, "");
+    const auto cone = findCone(nodes, outputs);
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+      if (!cone[i]) {
+        writer.exclude(i);
+      }
+    }
+    gradModule.visit(writer);
+
+    f << "/* Frozen Parameters */" << std::endl;
+    f << std::endl;
+    f << "#define AXON_TRAINABLE_PARAMETERS " << trainable.size() << std::endl;
+    f << std::endl;
+    f << "/* The parameter index of each element of the gradient written by axon_grad_trainable. */" << std::endl;
+    f << "static const uint32_t axon_trainable_index[" << std::max<size_t>(trainable.size(), 1) << "] = {";
+    for (size_t i = 0; i < trainable.size(); i++) {
+      f << ((i % 16) == 0 ? "\n  " : " ") << trainable[i] << ',';
+    }
+    f << (trainable.empty() ? " 0 };" : "\n};") << std::endl;
+    f << std::endl;
+    f << "/**" << std::endl;
+    f << " * @brief Like axon_grad, but skips the frozen parameters." << std::endl;
+    f << " *" << std::endl;
+    f << " * @param output Receives the AXON_TRAINABLE_PARAMETERS gradients of the trainable parameters, in the"
+      << std::endl;
+    f << " *               order of axon_trainable_index." << std::endl;
+    f << " * */" << std::endl;
+    functions.define(f,
+                     "axon_grad_trainable",
+                     { "const float* AXON_RESTRICT parameters",
+                       "const float* AXON_RESTRICT input",
+                       "float* AXON_RESTRICT output" },
+                     writer);
+  }
+
+  /* Splits the eval module into the expressions that only depend on parameters and constants, which are computed
+   * once per parameter update by axon_prepare, and the rest, which is computed for every sample by
+   * axon_eval_prepared. Only the parameter-only values that the per-sample part actually uses are cached.
+   * */
+  static void writePrepared(std::ostream& f, CFunctionSink& functions, const Module& evalModule)
+  {
+    const auto nodes = analyzeModule(evalModule);
+
+    std::vector<bool> inputs(nodes.size(), false);
+    for (size_t i = 0; i < nodes.size(); i++) {
+      inputs[i] = (nodes[i].kind == ExprNode::Kind::input);
+    }
+
+    auto perSample = findDependents(nodes, inputs);
+    for (size_t i = 0; i < nodes.size(); i++) {
+      if (nodes[i].kind == ExprNode::Kind::output) {
+        perSample[i] = true;
+      }
+    }
+
+    // The values that do not depend on the input but are operands of values that do. Computed ones are cached, and
+    // the parameters and constants among them are the only ones that axon_eval_prepared still has to load.
+    std::vector<uint32_t> cached;
+    std::vector<bool> isCached(nodes.size(), false);
+    std::vector<bool> usedPerSample(nodes.size(), false);
+    for (size_t i = 0; i < nodes.size(); i++) {
+      if (!perSample[i]) {
+        continue;
+      }
+      for (uint32_t j = 0; j < nodes[i].numOperands; j++) {
+        const auto op = nodes[i].operands[j];
+        usedPerSample[op] = true;
+        if (!perSample[op] && nodes[op].computed() && !isCached[op]) {
+          isCached[op] = true;
+          cached.emplace_back(op);
+        }
+      }
+    }
+
+    std::sort(cached.begin(), cached.end());
+
+    const auto prepareCone = findCone(nodes, cached);
+
+    CExprWriter prepareWriter;
+    CExprWriter sampleWriter;
+
+    std::map<uint32_t, size_t> cacheSlots;
+    for (const auto index : cached) {
+      const auto slot = cacheSlots.size();
+      cacheSlots.emplace(index, slot);
+    }
+
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+      if (!prepareCone[i]) {
+        prepareWriter.exclude(i);
+      }
+
+      const auto slot = cacheSlots.find(i);
+      if (slot != cacheSlots.end()) {
+        prepareWriter.store(i, { "cache", static_cast<uint32_t>(slot->second) });
+        sampleWriter.substitute(i, { "cache", static_cast<uint32_t>(slot->second) });
+      } else if (!perSample[i] && (nodes[i].computed() || !usedPerSample[i])) {
+        sampleWriter.exclude(i);
+      }
+    }
+
+    evalModule.visit(prepareWriter);
+    evalModule.visit(sampleWriter);
+
+    f << "/* The number of values computed by axon_prepare (at least 1, so that it can be used as an array size). */"
+      << std::endl;
+    f << "#define AXON_CACHE_SIZE " << std::max<size_t>(cached.size(), 1) << std::endl;
+    f << std::endl;
+    f << "/**" << std::endl;
+    f << " * @brief Computes the values of the network that do not depend on the input." << std::endl;
+    f << " *" << std::endl;
+    f << " * @details This only has to be called again when the parameters change." << std::endl;
+    f << " * */" << std::endl;
+    functions.define(f,
+                     "axon_prepare",
+                     { "const float* AXON_RESTRICT parameters",
+                       "float* AXON_RESTRICT cache" },
+                     prepareWriter);
+    f << "/**" << std::endl;
+    f << " * @brief Equivalent to axon_eval, but reads the input-independent values from the cache." << std::endl;
+    f << " *" << std::endl;
+    f << " * @details The cache has to be filled by axon_prepare, with the same parameters." << std::endl;
+    f << " * */" << std::endl;
+    functions.define(f,
+                     "axon_eval_prepared",
+                     { "const float* AXON_RESTRICT parameters",
+                       "const float* AXON_RESTRICT cache",
+                       "const float* AXON_RESTRICT input",
+                       "float* AXON_RESTRICT output" },
+                     sampleWriter);
   }
 
+  /* Emits a forward pass that saves the values needed by the backward pass to a tape, and a backward pass that reads
+   * them from the tape instead of computing them again. The backward module starts with the same expressions as the
+   * eval module, followed by the inputs that receive the output gradients and then the reverse sweep.
+   * */
+  static void writeTape(std::ostream& f,
+                        CFunctionSink& functions,
+                        const Module& evalModule,
+                        const Module& backwardModule)
+  {
+    const auto evalNodes = analyzeModule(evalModule);
+    const auto nodes = analyzeModule(backwardModule);
+
+    // The gradients of the outputs are the last inputs of the backward module.
+    const auto numForwardInputs = backwardModule.numInputs() - evalModule.numOutputs();
+
+    uint32_t reverseStart = static_cast<uint32_t>(nodes.size());
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+      if ((nodes[i].kind == ExprNode::Kind::input) && (nodes[i].index >= numForwardInputs)) {
+        reverseStart = i;
+        break;
+      }
+    }
+
+    const auto isLeaf = [&nodes](const uint32_t i) {
+      return (nodes[i].kind == ExprNode::Kind::param) || (nodes[i].kind == ExprNode::Kind::constant);
+    };
+
+    std::vector<bool> used(nodes.size(), false);
+    for (uint32_t i = reverseStart; i < nodes.size(); i++) {
+      for (uint32_t j = 0; j < nodes[i].numOperands; j++) {
+        used[nodes[i].operands[j]] = true;
+      }
+    }
+
+    std::map<uint32_t, size_t> tapeSlots;
+
+    CExprWriter forwardWriter;
+    CExprWriter backwardWriter;
+    backwardWriter.redirectOutputs(0, "grad");
+
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+      if (i >= reverseStart) {
+        if (nodes[i].kind == ExprNode::Kind::input) {
+          backwardWriter.substitute(i, { "dloss_doutput", nodes[i].index - numForwardInputs });
+        }
+        continue;
+      }
+      if (!used[i]) {
+        backwardWriter.exclude(i);
+        continue;
+      }
+      if (isLeaf(i)) {
+        continue;
+      }
+      if ((i >= evalNodes.size()) || (evalNodes[i].kind == ExprNode::Kind::output)) {
+        throw Exception("the backward pass depends on a value that is not computed by the eval module");
+      }
+      const CStatement::Access slot{ "tape", static_cast<uint32_t>(tapeSlots.size()) };
+      tapeSlots.emplace(i, tapeSlots.size());
+      forwardWriter.store(i, slot);
+      backwardWriter.substitute(i, slot);
+    }
+
+    evalModule.visit(forwardWriter);
+    backwardModule.visit(backwardWriter);
+
+    f << "/* The number of values saved by axon_forward for axon_backward (at least 1, for use as an array size). */"
+      << std::endl;
+    f << "#define AXON_TAPE_SIZE " << std::max<size_t>(tapeSlots.size(), 1) << std::endl;
+    f << std::endl;
+    f << "/**" << std::endl;
+    f << " * @brief Computes the same outputs as axon_eval, and saves the values needed by axon_backward to the tape."
+      << std::endl;
+    f << " * */" << std::endl;
+    functions.define(f,
+                     "axon_forward",
+                     { "const float* AXON_RESTRICT parameters",
+                       "const float* AXON_RESTRICT input",
+                       "float* AXON_RESTRICT output",
+                       "float* AXON_RESTRICT tape" },
+                     forwardWriter);
+    f << "/**" << std::endl;
+    f << " * @brief Backpropagates the gradient of the loss from the outputs of axon_forward to the parameters."
+      << std::endl;
+    f << " *" << std::endl;
+    f << " * @param tape The tape filled by axon_forward, with the same parameters." << std::endl;
+    f << " *" << std::endl;
+    f << " * @param dloss_doutput The gradient of the loss with respect to each of the AXON_EVAL_OUTPUTS outputs."
+      << std::endl;
+    f << " *" << std::endl;
+    f << " * @param grad Receives the gradient of the loss with respect to each of the AXON_PARAMETERS parameters."
+      << std::endl;
+    f << " * */" << std::endl;
+    functions.define(f,
+                     "axon_backward",
+                     { "const float* AXON_RESTRICT parameters",
+                       "const float* AXON_RESTRICT tape",
+                       "const float* AXON_RESTRICT dloss_doutput",
+                       "float* AXON_RESTRICT grad" },
+                     backwardWriter);
+  }
+
+  /* Emits the Jacobian-vector product. The tangents of the selected inputs are the last inputs of the JVP module, and
+   * are read from their own buffer.
+   * */
+  static void writeJvp(std::ostream& f, CFunctionSink& functions, const Module& jvpModule, const uint32_t numTangents)
+  {
+    const auto nodes = analyzeModule(jvpModule);
+
+    const auto numPrimalInputs = jvpModule.numInputs() - numTangents;
+
+    std::vector<uint32_t> outputs;
+
+    CExprWriter writer;
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+      if ((nodes[i].kind == ExprNode::Kind::input) && (nodes[i].index >= numPrimalInputs)) {
+        writer.substitute(i, { "tangent", nodes[i].index - numPrimalInputs });
+      } else if (nodes[i].kind == ExprNode::Kind::output) {
+        outputs.emplace_back(i);
+      }
+    }
+
+    const auto cone = findCone(nodes, outputs);
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+      if (!cone[i]) {
+        writer.exclude(i);
+      }
+    }
+
+    jvpModule.visit(writer);
+
+    f << "#define AXON_JVP_INPUTS " << numPrimalInputs << std::endl;
+    f << "#define AXON_JVP_TANGENTS " << numTangents << std::endl;
+    f << "#define AXON_JVP_OUTPUTS " << jvpModule.numOutputs() << std::endl;
+    f << std::endl;
+    f << "/**" << std::endl;
+    f << " * @brief Computes the directional derivative of the JVP outputs, along the given input tangents."
+      << std::endl;
+    f << " *" << std::endl;
+    f << " * @param input The AXON_JVP_INPUTS inputs at which the derivative is taken." << std::endl;
+    f << " *" << std::endl;
+    f << " * @param tangent The AXON_JVP_TANGENTS tangents, one per differentiated input." << std::endl;
+    f << " *" << std::endl;
+    f << " * @param output Receives the AXON_JVP_OUTPUTS tangents of the outputs." << std::endl;
+    f << " * */" << std::endl;
+    functions.define(f,
+                     "axon_jvp",
+                     { "const float* AXON_RESTRICT parameters",
+                       "const float* AXON_RESTRICT input",
+                       "const float* AXON_RESTRICT tangent",
+                       "float* AXON_RESTRICT output" },
+                     writer);
+  }
+
+  /* Emits the Hessian-vector product. The vector is made of the last inputs of the HVP module, one per parameter.
+   * */
+  static void writeHvp(std::ostream& f, CFunctionSink& functions, const Module& hvpModule)
+  {
+    const auto nodes = analyzeModule(hvpModule);
+
+    const auto numInputs = hvpModule.numInputs() - hvpModule.numParameters();
+
+    std::vector<uint32_t> outputs;
+
+    CExprWriter writer;
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+      if ((nodes[i].kind == ExprNode::Kind::input) && (nodes[i].index >= numInputs)) {
+        writer.substitute(i, { "vector", nodes[i].index - numInputs });
+      } else if (nodes[i].kind == ExprNode::Kind::output) {
+        outputs.emplace_back(i);
+      }
+    }
+
+    const auto cone = findCone(nodes, outputs);
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+      if (!cone[i]) {
+        writer.exclude(i);
+      }
+    }
+
+    hvpModule.visit(writer);
+
+    f << "#define AXON_HVP_INPUTS " << numInputs << std::endl;
+    f << std::endl;
+    f << "/**" << std::endl;
+    f << " * @brief Computes the product of the Hessian of the loss, with respect to the parameters, and a vector."
+      << std::endl;
+    f << " *" << std::endl;
+    f << " * @param input The AXON_HVP_INPUTS inputs of the sample, like the input of axon_grad." << std::endl;
+    f << " *" << std::endl;
+    f << " * @param vector The AXON_PARAMETERS elements of the vector to multiply with." << std::endl;
+    f << " *" << std::endl;
+    f << " * @param output Receives the AXON_PARAMETERS elements of the product." << std::endl;
+    f << " * */" << std::endl;
+    functions.define(f,
+                     "axon_hvp",
+                     { "const float* AXON_RESTRICT parameters",
+                       "const float* AXON_RESTRICT input",
+                       "const float* AXON_RESTRICT vector",
+                       "float* AXON_RESTRICT output" },
+                     writer);
+  }
+
+  /* Emits one eval function per output group, which only computes the backward cone of the outputs in that group.
+   * */
+  static void writeOutputGroups(std::ostream& f,
+                                CFunctionSink& functions,
+                                const Module& evalModule,
+                                const std::vector<Compiler::OutputGroup>& groups)
+  {
+    const auto nodes = analyzeModule(evalModule);
+
+    uint32_t offset{};
+
+    for (const auto& group : groups) {
+      if (!isIdentifier(group.name) || (group.name == "prepared") || (group.name.rfind("stage_", 0) == 0)) {
+        throw Exception("output group name \"" + group.name + "\" cannot be used as part of a function name");
+      }
+
+      const auto count = static_cast<uint32_t>(group.outputs.size());
+
+      std::vector<uint32_t> roots;
+      for (uint32_t i = 0; i < nodes.size(); i++) {
+        const auto& node = nodes[i];
+        if ((node.kind == ExprNode::Kind::output) && (node.index >= offset) && (node.index < (offset + count))) {
+          roots.emplace_back(i);
+        }
+      }
+
+      const auto cone = findCone(nodes, roots);
+
+      CExprWriter writer;
+      writer.offsetOutputs(offset);
+      for (uint32_t i = 0; i < nodes.size(); i++) {
+        if (!cone[i]) {
+          writer.exclude(i);
+        }
+      }
+      evalModule.visit(writer);
+
+      const auto name = "axon_eval_" + group.name;
+      f << "#define AXON_EVAL_" << toUpper(group.name) << "_OUTPUTS " << count << std::endl;
+      f << std::endl;
+      f << "/**" << std::endl;
+      f << " * @brief Computes only the outputs in the \"" << group.name << "\" group, like axon_eval." << std::endl;
+      f << " *" << std::endl;
+      f << " * @param output Receives the " << count << " output(s) of the group, which are outputs " << offset
+        << " to " << (offset + count) << " (exclusive) of axon_eval." << std::endl;
+      f << " * */" << std::endl;
+      functions.define(f,
+                       name,
+                       { "const float* AXON_RESTRICT parameters",
+                         "const float* AXON_RESTRICT input",
+                         "float* AXON_RESTRICT output" },
+                       writer);
+
+      offset += count;
+    }
+  }
+
+  /* Splits the eval module into one function per declared stage. Every computed value belongs to the earliest stage
+   * at which all of its inputs are known. Values that a later stage needs are passed on through the stage buffer,
+   * while parameters and constants are just read again wherever they are used.
+   * */
+  static void writeStages(std::ostream& f,
+                          CFunctionSink& functions,
+                          const Module& evalModule,
+                          const std::vector<Compiler::EvalStage>& stages)
+  {
+    if (stages.size() < 2) {
+      throw Exception("staged evaluation needs at least two stages");
+    }
+
+    const auto nodes = analyzeModule(evalModule);
+
+    constexpr auto unassigned = static_cast<uint32_t>(-1);
+
+    std::vector<uint32_t> level(nodes.size(), unassigned);
+    std::map<uint32_t, size_t> inputSlots;
+
+    for (uint32_t k = 0; k < stages.size(); k++) {
+      const auto& name = stages[k].name;
+      if (!isIdentifier(name)) {
+        throw Exception("eval stage name \"" + name + "\" is not a valid C identifier");
+      }
+      for (size_t j = 0; j < stages[k].inputs.size(); j++) {
+        const auto index = stages[k].inputs[j].index();
+        if ((index >= nodes.size()) || (nodes[index].kind != ExprNode::Kind::input)) {
+          throw Exception("eval stage \"" + name + "\" contains a value that is not an input");
+        }
+        if (level[index] != unassigned) {
+          throw Exception("eval stage \"" + name + "\" contains an input that already belongs to a stage");
+        }
+        level[index] = k;
+        inputSlots.emplace(index, j);
+      }
+    }
+
+    const auto last = static_cast<uint32_t>(stages.size() - 1);
+
+    std::vector<uint32_t> outputs;
+
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+      switch (nodes[i].kind) {
+        case ExprNode::Kind::input:
+          if (level[i] == unassigned) {
+            throw Exception("every input of the eval module has to belong to an eval stage");
+          }
+          break;
+        case ExprNode::Kind::param:
+        case ExprNode::Kind::constant:
+          level[i] = 0;
+          break;
+        case ExprNode::Kind::unary:
+        case ExprNode::Kind::binary:
+          level[i] = 0;
+          for (uint32_t j = 0; j < nodes[i].numOperands; j++) {
+            level[i] = std::max(level[i], level[nodes[i].operands[j]]);
+          }
+          break;
+        case ExprNode::Kind::output:
+          level[i] = last;
+          outputs.emplace_back(i);
+          break;
+      }
+    }
+
+    const auto needed = findCone(nodes, outputs);
+
+    const auto isLeaf = [&nodes](const uint32_t i) {
+      return (nodes[i].kind == ExprNode::Kind::param) || (nodes[i].kind == ExprNode::Kind::constant);
+    };
+
+    std::map<uint32_t, size_t> stageSlots;
+
+    std::vector<CExprWriter> writers(stages.size());
+
+    for (uint32_t k = 0; k < stages.size(); k++) {
+      std::vector<bool> emitted(nodes.size(), false);
+      std::vector<bool> passed(nodes.size(), false);
+
+      for (uint32_t i = 0; i < nodes.size(); i++) {
+        if (!needed[i] || isLeaf(i) || (level[i] != k)) {
+          continue;
+        }
+        emitted[i] = true;
+        for (uint32_t j = 0; j < nodes[i].numOperands; j++) {
+          const auto op = nodes[i].operands[j];
+          if (isLeaf(op)) {
+            emitted[op] = true;
+          } else if (level[op] < k) {
+            passed[op] = true;
+          }
+        }
+      }
+
+      for (uint32_t i = 0; i < nodes.size(); i++) {
+        if (passed[i]) {
+          auto slot = stageSlots.find(i);
+          if (slot == stageSlots.end()) {
+            slot = stageSlots.emplace(i, stageSlots.size()).first;
+            writers[level[i]].store(i, { "stage", static_cast<uint32_t>(slot->second) });
+          }
+          writers[k].substitute(i, { "stage", static_cast<uint32_t>(slot->second) });
+        } else if (!emitted[i]) {
+          writers[k].exclude(i);
+        } else if (nodes[i].kind == ExprNode::Kind::input) {
+          writers[k].substitute(i, { "input", static_cast<uint32_t>(inputSlots.at(i)) });
+        }
+      }
+    }
+
+    for (auto& writer : writers) {
+      evalModule.visit(writer);
+    }
+
+    f << "/* The number of values passed between eval stages (at least 1, so that it can be used as an array size). */"
+      << std::endl;
+    f << "#define AXON_EVAL_STAGE_SIZE " << std::max<size_t>(stageSlots.size(), 1) << std::endl;
+    f << std::endl;
+    for (const auto& stage : stages) {
+      f << "#define AXON_EVAL_STAGE_" << toUpper(stage.name) << "_INPUTS " << stage.inputs.size() << std::endl;
+    }
+    f << std::endl;
+
+    for (uint32_t k = 0; k < stages.size(); k++) {
+      const auto name = "axon_eval_stage_" + stages[k].name;
+      f << "/**" << std::endl;
+      if (k == 0) {
+        f << " * @brief The first eval stage, which fills the stage buffer for the stages after it." << std::endl;
+      } else if (k < last) {
+        f << " * @brief An intermediate eval stage, which reads the stage buffer and adds its own values to it."
+          << std::endl;
+      } else {
+        f << " * @brief The last eval stage, which computes the outputs from the stage buffer and its own inputs."
+          << std::endl;
+      }
+      f << " *" << std::endl;
+      f << " * @param input The " << stages[k].inputs.size() << " input(s) of this stage, in declaration order."
+        << std::endl;
+      f << " * */" << std::endl;
+      if (k < last) {
+        functions.define(f,
+                         name,
+                         { "const float* AXON_RESTRICT parameters",
+                           "const float* AXON_RESTRICT input",
+                           "float* AXON_RESTRICT stage" },
+                         writers[k]);
+      } else {
+        functions.define(f,
+                         name,
+                         { "const float* AXON_RESTRICT parameters",
+                           "const float* AXON_RESTRICT stage",
+                           "const float* AXON_RESTRICT input",
+                           "float* AXON_RESTRICT output" },
+                         writers[k]);
+      }
+    }
+  }
+
+  /* Emits the incremental evaluation functions. The state keeps every input and computed value that the outputs depend
+   * on. Updating an input group recomputes the values downstream of its inputs and reads everything else from the
+   * state, so the cost of an update is proportional to the part of the network that the group affects.
+   * */
+  static void writeIncremental(std::ostream& f,
+                               CFunctionSink& functions,
+                               const Module& evalModule,
+                               const std::vector<std::pair<std::string, std::vector<uint32_t>>>& groups)
+  {
+    const auto nodes = analyzeModule(evalModule);
+
+    std::vector<uint32_t> outputs;
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+      if (nodes[i].kind == ExprNode::Kind::output) {
+        outputs.emplace_back(i);
+      }
+    }
+
+    const auto needed = findCone(nodes, outputs);
+
+    const auto isLeaf = [&nodes](const uint32_t i) {
+      return (nodes[i].kind == ExprNode::Kind::param) || (nodes[i].kind == ExprNode::Kind::constant);
+    };
+
+    std::map<uint32_t, size_t> stateSlots;
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+      if (needed[i] && !isLeaf(i) && (nodes[i].kind != ExprNode::Kind::output)) {
+        stateSlots.emplace(i, stateSlots.size());
+      }
+    }
+
+    const auto slotName = [&stateSlots](const uint32_t i) {
+      return CStatement::Access{ "state->values", static_cast<uint32_t>(stateSlots.at(i)) };
+    };
+
+    CExprWriter initWriter;
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+      if (!needed[i]) {
+        initWriter.exclude(i);
+      } else if (stateSlots.count(i) != 0) {
+        initWriter.store(i, slotName(i));
+      }
+    }
+    evalModule.visit(initWriter);
+
+    f << "/* The number of values kept by the incremental evaluation state. */" << std::endl;
+    f << "#define AXON_STATE_SIZE " << std::max<size_t>(stateSlots.size(), 1) << std::endl;
+    f << std::endl;
+    for (const auto& [name, inputs] : groups) {
+      if (!isIdentifier(name)) {
+        throw Exception("input group name \"" + name + "\" is not a valid C identifier");
+      }
+      f << "#define AXON_INPUT_GROUP_" << toUpper(name) << "_INPUTS " << inputs.size() << std::endl;
+    }
+    f << std::endl;
+    f << "/**" << std::endl;
+    f << " * @brief The intermediate values of the last evaluation, for incremental re-evaluation." << std::endl;
+    f << " * */" << std::endl;
+    f << "struct axon_state" << std::endl;
+    f << "{" << std::endl;
+    f << "  float values[AXON_STATE_SIZE];" << std::endl;
+    f << "};" << std::endl;
+    f << std::endl;
+    f << "typedef struct axon_state axon_state_z;" << std::endl;
+    f << std::endl;
+    f << "/**" << std::endl;
+    f << " * @brief Evaluates the network like axon_eval and keeps the intermediate values in the state." << std::endl;
+    f << " *" << std::endl;
+    f << " * @details Call this once before using the update functions, and again whenever the parameters" << std::endl;
+    f << " *          or the inputs that do not belong to a group change." << std::endl;
+    f << " * */" << std::endl;
+    functions.define(f,
+                     "axon_state_init",
+                     { "const float* AXON_RESTRICT parameters",
+                       "const float* AXON_RESTRICT input",
+                       "axon_state_z* AXON_RESTRICT state",
+                       "float* AXON_RESTRICT output" },
+                     initWriter);
+
+    for (const auto& [name, inputs] : groups) {
+      std::vector<bool> seeds(nodes.size(), false);
+      for (const auto index : inputs) {
+        seeds[index] = true;
+      }
+
+      const auto dirty = findDependents(nodes, seeds);
+
+      std::vector<bool> emitted(nodes.size(), false);
+      std::vector<bool> kept(nodes.size(), false);
+      for (uint32_t i = 0; i < nodes.size(); i++) {
+        if (!needed[i] || (!dirty[i] && (nodes[i].kind != ExprNode::Kind::output))) {
+          continue;
+        }
+        emitted[i] = true;
+        for (uint32_t j = 0; j < nodes[i].numOperands; j++) {
+          const auto op = nodes[i].operands[j];
+          if (isLeaf(op)) {
+            emitted[op] = true;
+          } else if (!dirty[op]) {
+            kept[op] = true;
+          }
+        }
+      }
+
+      CExprWriter writer;
+      for (uint32_t i = 0; i < nodes.size(); i++) {
+        if (kept[i]) {
+          writer.substitute(i, slotName(i));
+        } else if (!emitted[i]) {
+          writer.exclude(i);
+        } else if (nodes[i].kind != ExprNode::Kind::output) {
+          if (nodes[i].kind == ExprNode::Kind::input) {
+            const auto pos = std::find(inputs.begin(), inputs.end(), i) - inputs.begin();
+            writer.substitute(i, { "input", static_cast<uint32_t>(pos) });
+          }
+          if (stateSlots.count(i) != 0) {
+            writer.store(i, slotName(i));
+          }
+        }
+      }
+      evalModule.visit(writer);
+
+      const auto function = "axon_update_" + name;
+      f << "/**" << std::endl;
+      f << " * @brief Changes the inputs of the \"" << name << "\" group and only recomputes what depends on them."
+        << std::endl;
+      f << " *" << std::endl;
+      f << " * @param input The " << inputs.size() << " input(s) of the group, in declaration order." << std::endl;
+      f << " *" << std::endl;
+      f << " * @param output Receives all of the outputs, like axon_eval." << std::endl;
+      f << " * */" << std::endl;
+      functions.define(f,
+                       function,
+                       { "const float* AXON_RESTRICT parameters",
+                         "const float* AXON_RESTRICT input",
+                         "axon_state_z* AXON_RESTRICT state",
+                         "float* AXON_RESTRICT output" },
+                       writer);
+    }
+  }
+
+  static void writeParamsFile(std::ostream& f, const ParamNameWriter& paramNames, const Compiler::Options& options)
+  {
+    f << paramsFileSrc;
+    f << std::endl;
+    f << "#ifndef AXON_PARAMETERS_PATH" << std::endl;
+    f << "#define AXON_PARAMETERS_PATH " << std::quoted(options.parametersPath) << std::endl;
+    f << "#endif" << std::endl;
+    f << std::endl;
+    f << "#define AXON_PARAMS_NAMES " << paramNames.numNames() << std::endl;
+    if (paramNames.numNames() > 0) {
+      f << std::endl;
+      f << "static const struct axon_params_name axon_params_names[AXON_PARAMS_NAMES] = {" << std::endl;
+      for (const auto& [name, offset] : paramNames.names()) {
+        if (name.size() >= paramsNameSize) {
+          throw Exception("parameter name \"" + name + "\" is too long for the parameter file format");
+        }
+        f << "  { " << offset << ", " << std::quoted(name) << " }," << std::endl;
+      }
+      f << "};" << std::endl;
+    }
+    f << paramsFileFunctionsSrc;
+  }
+
+public:
   void exportLean(const Module& evalModule,
                   const std::vector<float>& parameters,
                   const std::filesystem::path& outputDir) override
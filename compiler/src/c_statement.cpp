@@ -0,0 +1,280 @@
+#include "c_statement.hpp"
+
+#include <ostream>
+#include <sstream>
+
+namespace axon {
+
+namespace {
+
+using Op = CStatement::Op;
+
+using Access = CStatement::Access;
+
+/* This class is for writing the code of a statement, with the indices made relative to the bases of their arrays. */
+class StatementFormatter final
+{
+public:
+  StatementFormatter(std::ostream& code, const CStatement& s, const std::map<std::string, uint32_t>& bases)
+    : m_code(code)
+    , m_s(s)
+    , m_bases(bases)
+  {
+  }
+
+  void format()
+  {
+    switch (m_s.op) {
+      case Op::output:
+        m_code << element(m_s.access) << " = " << operand(0) << ';';
+        return;
+      case Op::accumulate:
+        m_code << element(m_s.access) << " += scale * " << operand(0) << ';';
+        return;
+      case Op::loop:
+        formatLoop();
+        return;
+      case Op::call:
+        formatCall();
+        return;
+      default:
+        break;
+    }
+
+    m_code << "const float " << name(m_s.values[0]) << " = ";
+    switch (m_s.op) {
+      case Op::param:
+      case Op::load:
+        m_code << element(m_s.access);
+        break;
+      case Op::constant:
+        m_code << m_s.constant;
+        break;
+      case Op::negate:
+        m_code << '-' << operand(0);
+        break;
+      case Op::rcp:
+        m_code << "1.0F / " << operand(0);
+        break;
+      case Op::sqrt:
+        m_code << "sqrtf(" << operand(0) << ")";
+        break;
+      case Op::exp:
+        m_code << "expf(" << operand(0) << ")";
+        break;
+      case Op::relu:
+        m_code << "fmaxf(" << operand(0) << ", 0.0F)";
+        break;
+      case Op::sigmoid:
+        m_code << "1.0F / (1.0F + expf(-" << operand(0) << "))";
+        break;
+      case Op::heaviside:
+        m_code << operand(0) << " > 0.0F ? 1.0F : 0.0F";
+        break;
+      case Op::sin:
+        m_code << "sinf(" << operand(0) << ")";
+        break;
+      case Op::cos:
+        m_code << "cosf(" << operand(0) << ")";
+        break;
+      case Op::checkpoint:
+        m_code << "axon_checkpoint(" << operand(0) << ")";
+        break;
+      case Op::add:
+        m_code << operand(0) << " + " << operand(1);
+        break;
+      case Op::sub:
+        m_code << operand(0) << " - " << operand(1);
+        break;
+      case Op::mul:
+        m_code << operand(0) << " * " << operand(1);
+        break;
+      default:
+        break;
+    }
+    m_code << ';';
+    formatStores(m_s.values[0]);
+  }
+
+protected:
+  [[nodiscard]] static auto name(const uint32_t value) -> std::string { return "v" + std::to_string(value); }
+
+  [[nodiscard]] auto operand(const size_t i) const -> std::string { return name(m_s.operands[i]); }
+
+  [[nodiscard]] auto index(const Access& a) const -> uint32_t
+  {
+    const auto base = m_bases.find(a.array);
+    return (base == m_bases.end()) ? a.index : (a.index - base->second);
+  }
+
+  [[nodiscard]] auto element(const Access& a) const -> std::string
+  {
+    return a.array + "[" + std::to_string(index(a)) + "]";
+  }
+
+  /* Writes the stores of a value, each on a line of its own. */
+  void formatStores(const uint32_t value)
+  {
+    for (const auto& [stored, target] : m_s.stores) {
+      if (stored == value) {
+        m_code << "\n  " << element(target) << " = " << name(value) << ';';
+      }
+    }
+  }
+
+  /* Writes a loop over the rows of a matrix product, which defines the sum of every row. */
+  void formatLoop()
+  {
+    const auto name = std::to_string(m_s.values[0]);
+    const auto numTerms = m_s.operands.size() - (m_s.constant.empty() ? 1 : 0);
+    const auto rows = m_s.loop.rows;
+
+    m_code << "const float x" << name << "[" << numTerms << "] = {";
+    for (size_t k = 0; k < numTerms; k++) {
+      m_code << (((k % 8) == 0) && (k > 0) ? "\n    " : " ") << operand(k) << ((k + 1) < numTerms ? "," : "");
+    }
+    m_code << " };\n";
+
+    std::ostringstream offset;
+    if (index(m_s.access) > 0) {
+      offset << index(m_s.access) << " + ";
+    }
+    if (rows > 1) {
+      offset << "i * " << m_s.loop.rowStride << " + ";
+    }
+    offset << "k";
+    if (m_s.loop.stride != 1) {
+      offset << " * " << m_s.loop.stride;
+    }
+
+    const auto start = m_s.constant.empty() ? operand(m_s.operands.size() - 1) : m_s.constant;
+    const auto sum = (rows > 1) ? ("r" + name + "[i]") : ("sum" + name);
+    const auto term = m_s.access.array + "[" + offset.str() + "] * x" + name + "[k]";
+
+    if (rows > 1) {
+      m_code << "  float r" << name << "[" << rows << "];\n";
+      m_code << "  for (uint32_t i = 0; i < " << rows << "; i++) {\n";
+      m_code << "    " << sum << " = " << start << ";\n";
+      m_code << "  }\n";
+      m_code << "  for (uint32_t k = 0; k < " << numTerms << "; k++) {\n";
+      m_code << "    for (uint32_t i = 0; i < " << rows << "; i++) {\n";
+      m_code << "      " << sum << " += " << term << ";\n";
+      m_code << "    }\n";
+      m_code << "  }\n";
+    } else {
+      m_code << "  float " << sum << " = " << start << ";\n";
+      m_code << "  for (uint32_t k = 0; k < " << numTerms << "; k++) {\n";
+      m_code << "    " << sum << " += " << term << ";\n";
+      m_code << "  }\n";
+    }
+
+    for (size_t r = 0; r < m_s.values.size(); r++) {
+      const auto value = m_s.values[r];
+      m_code << "  const float " << StatementFormatter::name(value) << " = ";
+      if (rows > 1) {
+        m_code << "r" << name << "[" << r << "];";
+      } else {
+        m_code << sum << ";";
+      }
+      formatStores(value);
+      if ((r + 1) < m_s.values.size()) {
+        m_code << '\n';
+      }
+    }
+  }
+
+  /* Writes a call, which passes the operands in one array and receives the values in another one. */
+  void formatCall()
+  {
+    const auto in = "in" + std::to_string(m_s.values[0]);
+    const auto out = "out" + std::to_string(m_s.values[0]);
+
+    m_code << "const float " << in << "[" << m_s.operands.size() << "] = {";
+    for (size_t k = 0; k < m_s.operands.size(); k++) {
+      m_code << (((k % 8) == 0) && (k > 0) ? "\n    " : " ") << operand(k)
+             << ((k + 1) < m_s.operands.size() ? "," : "");
+    }
+    m_code << " };\n";
+    m_code << "  float " << out << "[" << m_s.values.size() << "];\n";
+    m_code << "  " << m_s.callee << "(";
+    for (const auto& a : m_s.arguments) {
+      m_code << a.array;
+      if (index(a) > 0) {
+        m_code << " + " << index(a);
+      }
+      m_code << ", ";
+    }
+    m_code << in << ", " << out << ");";
+    for (size_t k = 0; k < m_s.values.size(); k++) {
+      m_code << "\n  const float " << name(m_s.values[k]) << " = " << out << "[" << k << "];";
+    }
+  }
+
+private:
+  std::ostream& m_code;
+
+  const CStatement& m_s;
+
+  const std::map<std::string, uint32_t>& m_bases;
+};
+
+} // namespace
+
+auto
+formatStatement(const CStatement& s, const std::map<std::string, uint32_t>& bases) -> std::string
+{
+  std::ostringstream code;
+  StatementFormatter(code, s, bases).format();
+  return code.str();
+}
+
+auto
+formatStatements(const std::vector<CStatement>& statements) -> std::string
+{
+  std::ostringstream stream;
+  for (const auto& statement : statements) {
+    stream << "  " << formatStatement(statement) << '\n';
+  }
+  return stream.str();
+}
+
+auto
+statementArguments(const CStatement& s) -> std::set<std::string>
+{
+  // Members such as state->values belong to the argument that they are accessed through.
+  const auto argument = [](const std::string& array) { return array.substr(0, array.find("->")); };
+
+  std::set<std::string> result;
+  switch (s.op) {
+    case Op::param:
+    case Op::load:
+    case Op::output:
+    case Op::loop:
+      result.emplace(argument(s.access.array));
+      break;
+    case Op::accumulate:
+      result.emplace(argument(s.access.array));
+      result.emplace("scale");
+      break;
+    case Op::call:
+      for (const auto& a : s.arguments) {
+        result.emplace(argument(a.array));
+      }
+      break;
+    default:
+      break;
+  }
+  for (const auto& store : s.stores) {
+    result.emplace(argument(store.second.array));
+  }
+  return result;
+}
+
+auto
+argumentName(const std::string& param) -> std::string
+{
+  const auto pos = param.find_last_of(" *");
+  return (pos == std::string::npos) ? param : param.substr(pos + 1);
+}
+
+} // namespace axon
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+
+namespace axon {
+
+/**
+ * @brief A statement of a generated C function body.
+ *
+ * @details The code is generated from these fields by formatStatement, so that the passes over the statements can
+ *          look at what a statement does and change where it reads from without parsing code.
+ * */
+struct CStatement final
+{
+  /**
+   * @brief What a statement computes.
+   * */
+  enum class Op
+  {
+    param,
+    load,
+    constant,
+    negate,
+    rcp,
+    sqrt,
+    exp,
+    relu,
+    sigmoid,
+    heaviside,
+    sin,
+    cos,
+    checkpoint,
+    add,
+    sub,
+    mul,
+    output,
+    accumulate,
+    loop,
+    call
+  };
+
+  /**
+   * @brief An element of an array that a statement reads or writes, such as parameters[12].
+   * */
+  struct Access final
+  {
+    /**
+     * @brief An argument of the function, or a member of one, such as state->values.
+     * */
+    std::string array;
+
+    uint32_t index{};
+  };
+
+  /**
+   * @brief The shape of a loop over the rows of a matrix product.
+   * */
+  struct Loop final
+  {
+    uint32_t rows{};
+
+    /**
+     * @brief The distance between the first parameters of consecutive rows.
+     * */
+    uint32_t rowStride{};
+
+    /**
+     * @brief The distance between the parameters of consecutive terms of a row.
+     * */
+    uint32_t stride{};
+  };
+
+  /**
+   * @brief The expressions whose values the statement defines. Output statements define none.
+   * */
+  std::vector<uint32_t> values;
+
+  /**
+   * @brief The values that the statement reads. For loops, these are the terms of the vector, followed by the initial
+   *        value of the sums if it is not a constant. For calls, these are the values passed to the function.
+   * */
+  std::vector<uint32_t> operands;
+
+  Op op{ Op::load };
+
+  /**
+   * @brief The element that parameter and load statements read and that output statements write. For loops, the first
+   *        parameter of the first row.
+   * */
+  Access access;
+
+  /**
+   * @brief The value of constant statements, as a C expression. For loops, the initial value of the sums, unless it is
+   *        one of the operands.
+   * */
+  std::string constant;
+
+  /**
+   * @brief The elements that the values are stored to, right after they are defined.
+   * */
+  std::vector<std::pair<uint32_t, Access>> stores;
+
+  Loop loop;
+
+  /**
+   * @brief The function that call statements call.
+   * */
+  std::string callee;
+
+  /**
+   * @brief The arguments that call statements pass to the function, each offset by the given index. The arrays of the
+   *        operands and of the values follow them.
+   * */
+  std::vector<Access> arguments;
+
+  /**
+   * @brief Whether the statement only reads the arguments, so that it can be repeated wherever its value is needed.
+   * */
+  [[nodiscard]] auto leaf() const -> bool { return (values.size() == 1) && operands.empty(); }
+};
+
+/**
+ * @brief Returns the code of a statement. Lines after the first one are indented.
+ *
+ * @param bases An offset for some of the arrays, which is subtracted from the indices of their elements. This is for
+ *              code that is passed pointers into the arrays, rather than the arrays themselves.
+ * */
+[[nodiscard]] auto
+formatStatement(const CStatement& s, const std::map<std::string, uint32_t>& bases = {}) -> std::string;
+
+/**
+ * @brief Returns the code of a function body, one statement per line.
+ * */
+[[nodiscard]] auto
+formatStatements(const std::vector<CStatement>& statements) -> std::string;
+
+/**
+ * @brief Returns the names of the function arguments that a statement reads or writes.
+ * */
+[[nodiscard]] auto
+statementArguments(const CStatement& s) -> std::set<std::string>;
+
+/**
+ * @brief Returns the name of a function parameter, from its declaration.
+ * */
+[[nodiscard]] auto
+argumentName(const std::string& param) -> std::string;
+
+} // namespace axon
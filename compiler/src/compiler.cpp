@@ -23,28 +23,157 @@ public:
     }
 
     m_evalModule = m_builder->build(outputs);
+
+    m_evalOutputs = outputs;
   }
 
-  void buildGradModule(const Value& loss) override
+  void buildEvalModule(const std::vector<OutputGroup>& groups) override
+  {
+    std::vector<Value> outputs;
+
+    for (size_t i = 0; i < groups.size(); i++) {
+      for (size_t j = 0; j < i; j++) {
+        if (groups[i].name == groups[j].name) {
+          throw Exception("output group \"" + groups[i].name + "\" already exists");
+        }
+      }
+      outputs.insert(outputs.end(), groups[i].outputs.begin(), groups[i].outputs.end());
+    }
+
+    buildEvalModule(outputs);
+
+    m_outputGroups = groups;
+  }
+
+  void buildGradModule(const Value& loss) override { buildGradModule(loss, {}); }
+
+  void buildGradModule(const Value& loss, const std::vector<Value>& auxOutputs) override
+  {
+    buildGradModule(std::vector<Value>{ loss }, auxOutputs);
+  }
+
+  void buildGradModule(const std::vector<Value>& losses) override { buildGradModule(losses, {}); }
+
+  void buildGradModule(const std::vector<Value>& losses, const std::vector<Value>& auxOutputs) override
   {
     if (m_gradModule) {
       throw Exception("grad module already created");
     }
 
-    m_gradModule = m_builder->buildWithGrad(loss);
+    m_gradModule = m_builder->buildWithGrad(losses, auxOutputs, m_options.checkpointSegments);
+
+    m_gradLosses = static_cast<uint32_t>(losses.size());
+  }
+
+  void buildBackwardModule() override
+  {
+    if (!m_evalModule) {
+      throw Exception("the eval module has to be built before the backward module");
+    }
+
+    if (m_backwardModule) {
+      throw Exception("backward module already created");
+    }
+
+    m_backwardModule = m_builder->buildBackward(m_evalOutputs);
+  }
+
+  void buildJvpModule(const std::vector<Value>& outputs, const std::vector<Value>& tangentInputs) override
+  {
+    if (m_jvpModule) {
+      throw Exception("JVP module already created");
+    }
+
+    m_jvpModule = m_builder->buildJvp(outputs, tangentInputs);
+
+    m_jvpTangents = static_cast<uint32_t>(tangentInputs.size());
+  }
+
+  void buildHvpModule(const Value& loss) override
+  {
+    if (m_hvpModule) {
+      throw Exception("HVP module already created");
+    }
+
+    m_hvpModule = m_builder->buildHvp(loss);
+  }
+
+  void freezeParameters(const std::string& name) override
+  {
+    if (m_gradModule || m_backwardModule) {
+      throw Exception("parameters have to be frozen before the grad and backward modules are built");
+    }
+
+    m_builder->freeze(name);
+  }
+
+  void markCheckpoint() override
+  {
+    if (m_gradModule) {
+      throw Exception("checkpoints have to be marked before the grad module is built");
+    }
+
+    m_builder->markCheckpoint();
+
+    m_checkpointMarks++;
+  }
+
+  void addEvalStage(const std::string& name, const std::vector<Value>& inputs) override
+  {
+    for (const auto& stage : m_evalStages) {
+      if (stage.name == name) {
+        throw Exception("eval stage \"" + name + "\" already exists");
+      }
+    }
+
+    m_evalStages.emplace_back(EvalStage{ name, inputs });
   }
 
   [[nodiscard]] auto getEvalModule() const -> const Module* override { return m_evalModule.get(); }
 
   [[nodiscard]] auto getGradModule() const -> const Module* override { return m_gradModule.get(); }
 
+  [[nodiscard]] auto getBackwardModule() const -> const Module* override { return m_backwardModule.get(); }
+
+  [[nodiscard]] auto getJvpModule() const -> const Module* override { return m_jvpModule.get(); }
+
+  [[nodiscard]] auto getHvpModule() const -> const Module* override { return m_hvpModule.get(); }
+
+  [[nodiscard]] auto getJvpTangents() const -> uint32_t override { return m_jvpTangents; }
+
+  [[nodiscard]] auto getGradLosses() const -> uint32_t override { return m_gradLosses; }
+
+  [[nodiscard]] auto getCheckpointMarks() const -> uint32_t override { return m_checkpointMarks; }
+
+  [[nodiscard]] auto getEvalStages() const -> const std::vector<EvalStage>& override { return m_evalStages; }
+
+  [[nodiscard]] auto getOutputGroups() const -> const std::vector<OutputGroup>& override { return m_outputGroups; }
+
 private:
   std::unique_ptr<ModuleBuilder> m_builder{ ModuleBuilder::create() };
 
   std::unique_ptr<Module> m_gradModule;
 
+  uint32_t m_gradLosses{};
+
+  uint32_t m_checkpointMarks{};
+
   std::unique_ptr<Module> m_evalModule;
 
+  std::unique_ptr<Module> m_backwardModule;
+
+  std::unique_ptr<Module> m_jvpModule;
+
+  uint32_t m_jvpTangents{};
+
+  std::unique_ptr<Module> m_hvpModule;
+
+  std::vector<Value> m_evalOutputs;
+
+  std::vector<EvalStage> m_evalStages;
+
+  std::vector<OutputGroup> m_outputGroups;
+
   Options m_options;
 };
 
@@ -6,8 +6,9 @@ namespace axon {
 
 Expr::~Expr() = default;
 
-InputExpr::InputExpr(const uint32_t index)
+InputExpr::InputExpr(const uint32_t index, const std::string_view& group)
   : m_index(index)
+  , m_group(group)
 {
 }
 
@@ -17,9 +18,16 @@ InputExpr::accept(ExprVisitor& visitor) const
   visitor.visit(*this);
 }
 
-ParamExpr::ParamExpr(const uint32_t index, const std::string_view& name)
+auto
+InputExpr::group() const -> std::string_view
+{
+  return m_group;
+}
+
+ParamExpr::ParamExpr(const uint32_t index, const std::string_view& name, const bool frozen)
   : m_index(index)
   , m_name(name)
+  , m_frozen(frozen)
 {
 }
 
@@ -107,6 +115,12 @@ CosExpr::accept(ExprVisitor& visitor) const
   visitor.visit(*this);
 }
 
+void
+CheckpointExpr::accept(ExprVisitor& visitor) const
+{
+  visitor.visit(*this);
+}
+
 BinaryExpr::BinaryExpr(const uint32_t l, const uint32_t r)
   : m_left(l)
   , m_right(r)
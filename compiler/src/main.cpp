@@ -6,11 +6,13 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <stdlib.h>
 
 #include "c_exporter.hpp"
+#include "module_analysis.hpp"
 
 namespace {
 
@@ -66,6 +68,8 @@ exec(int argc, char** argv)
 
   axon::Compiler::Options options;
 
+  std::string modulesPrefix;
+
   ArgQueue args(argc, argv);
 
   while (!args.empty()) {
@@ -97,6 +101,36 @@ exec(int argc, char** argv)
       continue;
     }
 
+    if (checkOpt(arg, "-c", "--checkpoint-segments")) {
+      options.checkpointSegments = args.popValue<uint32_t>(arg);
+      continue;
+    }
+
+    if (checkOpt(arg, "-s", "--source-files")) {
+      options.sourceFiles = args.popValue<uint32_t>(arg);
+      continue;
+    }
+
+    if (checkOpt(arg, "-k", "--chunk-size")) {
+      options.chunkSize = args.popValue<uint32_t>(arg);
+      continue;
+    }
+
+    if (checkOpt(arg, "-l", "--no-reroll")) {
+      options.reroll = false;
+      continue;
+    }
+
+    if (checkOpt(arg, "-b", "--no-outline")) {
+      options.outline = false;
+      continue;
+    }
+
+    if (checkOpt(arg, "-m", "--save-modules")) {
+      modulesPrefix = args.popValue<std::string>(arg);
+      continue;
+    }
+
     std::ostringstream what;
     what << "unknown option \"" << arg << "\"";
     throw axon::Exception(what.str());
@@ -116,12 +150,42 @@ exec(int argc, char** argv)
     throw axon::Exception("no grad module was defined");
   }
 
+  if ((options.checkpointSegments > 0) || (compiler->getCheckpointMarks() > 0)) {
+    const auto peak = axon::peakLiveValues(axon::analyzeModule(*gradModule));
+    const auto marks = compiler->getCheckpointMarks();
+    const auto segments = (marks > 0) ? (marks + 1) : options.checkpointSegments;
+    std::cout << "grad module: " << segments << " checkpoint segment(s)" << ((marks > 0) ? " (marked)" : "")
+              << ", at most " << peak << " live values (" << (static_cast<size_t>(peak) * sizeof(float)) << " bytes)"
+              << std::endl;
+  }
+
+  if (!modulesPrefix.empty()) {
+    // Each module is saved as <prefix>.<kind>.axm, see axon::loadModule. The files are loaded back and hashed, so that
+    // a file that would not load, or that loads as a different network, is reported here rather than when it is used.
+    const std::pair<const char*, const axon::Module*> modules[]{ { "eval", evalModule },
+                                                                 { "grad", gradModule },
+                                                                 { "backward", compiler->getBackwardModule() },
+                                                                 { "jvp", compiler->getJvpModule() },
+                                                                 { "hvp", compiler->getHvpModule() } };
+    for (const auto& [kind, module] : modules) {
+      if (module == nullptr) {
+        continue;
+      }
+      const auto path = modulesPrefix + "." + kind + ".axm";
+      axon::saveModule(*module, path);
+      const auto loaded = axon::loadModule(path);
+      if ((loaded->numExprs() != module->numExprs()) || (axon::hashModule(*loaded) != axon::hashModule(*module))) {
+        throw axon::Exception("module file \"" + path + "\" does not load as the module that was saved");
+      }
+    }
+  }
+
   auto exporter = axon::Exporter::create(options.exporter.c_str());
 
   if (options.release) {
     exporter->exportLean(*evalModule, {}, options.outputFile);
   } else {
-    exporter->exportFull(*evalModule, *gradModule, options.outputFile);
+    exporter->exportFull(*compiler, options);
   }
 }
 
@@ -6,7 +6,13 @@
 #include <axon/module_builder.hpp>
 #include <axon/value.hpp>
 
+#include "module_analysis.hpp"
+
+#include <algorithm>
+#include <functional>
 #include <map>
+#include <optional>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -20,6 +26,7 @@ namespace {
 
 class ModuleBuilderImpl;
 class GradModuleInserter;
+class JvpModuleInserter;
 
 class ModuleImpl final : public Module
 {
@@ -27,6 +34,8 @@ class ModuleImpl final : public Module
 
   friend GradModuleInserter;
 
+  friend JvpModuleInserter;
+
 public:
   [[nodiscard]] auto copy() const -> std::unique_ptr<Module> override { return std::make_unique<ModuleImpl>(*this); }
 
@@ -69,6 +78,73 @@ private:
   uint32_t m_numOutputs{};
 };
 
+/* Creates a copy of a computed expression, with its operands mapped to other values.
+ * */
+class ExprCloner final : public ExprVisitor
+{
+public:
+  explicit ExprCloner(std::function<uint32_t(uint32_t)> mapOperand)
+    : m_mapOperand(std::move(mapOperand))
+  {
+  }
+
+  [[nodiscard]] auto release() -> Expr* { return m_clone.release(); }
+
+  void visit(const InputExpr&) override { assert(false); }
+
+  void visit(const ParamExpr&) override { assert(false); }
+
+  void visit(const ConstExpr&) override { assert(false); }
+
+  void visit(const NegateExpr& e) override { cloneUnary(e); }
+
+  void visit(const RcpExpr& e) override { cloneUnary(e); }
+
+  void visit(const SqrtExpr& e) override { cloneUnary(e); }
+
+  void visit(const ExpExpr& e) override { cloneUnary(e); }
+
+  void visit(const ReLUExpr& e) override { cloneUnary(e); }
+
+  void visit(const SigmoidExpr& e) override { cloneUnary(e); }
+
+  void visit(const HeavisideExpr& e) override { cloneUnary(e); }
+
+  void visit(const SinExpr& e) override { cloneUnary(e); }
+
+  void visit(const CosExpr& e) override { cloneUnary(e); }
+
+  void visit(const CheckpointExpr& e) override { cloneUnary(e); }
+
+  void visit(const AddExpr& e) override { cloneBinary(e); }
+
+  void visit(const SubExpr& e) override { cloneBinary(e); }
+
+  void visit(const MulExpr& e) override { cloneBinary(e); }
+
+  void visit(const OutputExpr&) override { assert(false); }
+
+protected:
+  template<typename DerivedExpr>
+  void cloneUnary(const DerivedExpr& e)
+  {
+    m_clone = std::make_unique<DerivedExpr>(m_mapOperand(e.operand()));
+  }
+
+  template<typename DerivedExpr>
+  void cloneBinary(const DerivedExpr& e)
+  {
+    const auto left = m_mapOperand(e.left());
+    const auto right = m_mapOperand(e.right());
+    m_clone = std::make_unique<DerivedExpr>(left, right);
+  }
+
+private:
+  std::function<uint32_t(uint32_t)> m_mapOperand;
+
+  std::unique_ptr<Expr> m_clone;
+};
+
 class GradModuleInserter final : public ExprVisitor
 {
 public:
@@ -79,11 +155,72 @@ public:
 
   void registerGrad(const Expr* expr, Expr* gradExpr)
   {
+    if (m_pruned.count(expr) != 0) {
+      std::unique_ptr<Expr> unused(gradExpr);
+      return;
+    }
+
     const auto value = push(gradExpr);
 
     registerGrad(expr, value);
   }
 
+  /**
+   * @brief Stops gradients from being propagated into the expressions that are not marked as active.
+   *
+   * @details The reverse sweep has to skip the inactive expressions, since they never receive a gradient.
+   * */
+  void prune(const std::vector<bool>& active)
+  {
+    for (size_t i = 0; i < active.size(); i++) {
+      if (!active[i]) {
+        m_pruned.emplace(m_module->m_exprs.at(i).get());
+      }
+    }
+  }
+
+  /**
+   * @brief Recomputes a segment of the forward pass, for use by the reverse sweep of that segment.
+   *
+   * @details Every operand from outside of the segment, except for constants, is read through a checkpoint
+   *          expression. The reverse sweep then refers to the recomputed values, so the original values of the
+   *          segment do not have to stay alive until the backward pass reaches them.
+   *
+   * @param isConstant Whether each forward expression is a constant, which is used directly instead of reloaded.
+   *
+   * @param segment The indices of the computed expressions in the segment, in ascending order.
+   * */
+  void recompute(const std::vector<uint32_t>& segment, const std::vector<bool>& isConstant)
+  {
+    std::map<uint32_t, uint32_t> clones;
+
+    std::map<uint32_t, uint32_t> reloads;
+
+    const auto mapOperand = [this, &clones, &reloads, &isConstant](const uint32_t operand) -> uint32_t {
+      if (const auto it = clones.find(operand); it != clones.end()) {
+        return it->second;
+      }
+      if (isConstant[operand]) {
+        return operand;
+      }
+      if (const auto it = reloads.find(operand); it != reloads.end()) {
+        return it->second;
+      }
+      const auto reload = push(new CheckpointExpr(operand)).index();
+      reloads.emplace(operand, reload);
+      return reload;
+    };
+
+    for (const auto index : segment) {
+      ExprCloner cloner(mapOperand);
+      m_module->m_exprs.at(index)->accept(cloner);
+      clones.emplace(index, push(cloner.release()).index());
+    }
+
+    // Only the recomputed values are used by the reverse sweep. The reloads are only needed for recomputing them.
+    m_forward = std::move(clones);
+  }
+
   void visit(const ConstExpr&) override {}
 
   void visit(const InputExpr&) override {}
@@ -92,15 +229,38 @@ public:
   {
     const auto grad = findGrad(&e);
 
+    if (m_collectParamGrads) {
+      m_paramGrads[e.index()] = grad.index();
+      return;
+    }
+
     (void)push(new OutputExpr(e.index(), grad.index()));
   }
 
+  /**
+   * @brief Records the gradients of the parameters instead of emitting them as outputs, so that they can be processed
+   *        further. See paramGrads.
+   * */
+  void collectParamGrads() { m_collectParamGrads = true; }
+
+  /**
+   * @brief The index of the gradient value of each parameter that was reached by the reverse sweep.
+   * */
+  [[nodiscard]] auto paramGrads() const -> const std::map<uint32_t, uint32_t>& { return m_paramGrads; }
+
+  void visit(const CheckpointExpr& e) override
+  {
+    const auto grad = findGrad(&e);
+
+    registerGrad(m_module->m_exprs.at(e.operand()).get(), grad);
+  }
+
   void visit(const ReLUExpr& e) override
   {
     const auto grad = findGrad(&e);
     const auto x = e.operand();
 
-    const auto mask = push(new HeavisideExpr(x));
+    const auto mask = push(new HeavisideExpr(fwd(x)));
 
     registerGrad(m_module->m_exprs.at(x).get(), new MulExpr(grad.index(), mask.index()));
   }
@@ -109,7 +269,7 @@ public:
   {
     const auto grad = findGrad(&e);
     // TODO : investigate if its worth it to cache the sigmoid value in the forward pass
-    const auto x = push(new SigmoidExpr(e.operand()));
+    const auto x = push(new SigmoidExpr(fwd(e.operand())));
     const auto k = push(new ConstExpr(1.0F));
     const auto x0 = push(new SubExpr(k.index(), x.index()));
     const auto x1 = push(new MulExpr(x.index(), x0.index()));
@@ -136,8 +296,8 @@ public:
     const auto grad = findGrad(&e);
     const auto op = e.operand();
 
-    const auto rcp1 = push(new RcpExpr(op));
-    const auto rcp2 = push(new RcpExpr(op));
+    const auto rcp1 = push(new RcpExpr(fwd(op)));
+    const auto rcp2 = push(new RcpExpr(fwd(op)));
     const auto rcp_sq = push(new MulExpr(rcp1.index(), rcp2.index()));
     const auto piece = push(new NegateExpr(rcp_sq.index()));
 
@@ -150,7 +310,7 @@ public:
     const auto op = e.operand();
 
     const auto half = push(new ConstExpr(0.5f));
-    const auto s = push(new SqrtExpr(op));
+    const auto s = push(new SqrtExpr(fwd(op)));
     const auto rs = push(new RcpExpr(s.index()));
     const auto coeff = push(new MulExpr(half.index(), rs.index()));
 
@@ -162,7 +322,7 @@ public:
     const auto grad = findGrad(&e);
     const auto op = e.operand();
 
-    const auto ex = push(new ExpExpr(op));
+    const auto ex = push(new ExpExpr(fwd(op)));
     registerGrad(m_module->m_exprs.at(op).get(), new MulExpr(grad.index(), ex.index()));
   }
 
@@ -171,7 +331,7 @@ public:
     const auto grad = findGrad(&e);
     const auto x = e.operand();
 
-    const auto c = push(new CosExpr(x));
+    const auto c = push(new CosExpr(fwd(x)));
     registerGrad(m_module->m_exprs.at(x).get(), new MulExpr(grad.index(), c.index()));
   }
 
@@ -180,7 +340,7 @@ public:
     const auto grad = findGrad(&e);
     const auto x = e.operand();
 
-    const auto s = push(new SinExpr(x));
+    const auto s = push(new SinExpr(fwd(x)));
     const auto sNeg = push(new NegateExpr(s.index()));
     registerGrad(m_module->m_exprs.at(x).get(), new MulExpr(grad.index(), sNeg.index()));
   }
@@ -209,8 +369,8 @@ public:
     const auto grad = findGrad(&e);
     const auto l = e.left();
     const auto r = e.right();
-    registerGrad(m_module->m_exprs.at(l).get(), new MulExpr(grad.index(), r));
-    registerGrad(m_module->m_exprs.at(r).get(), new MulExpr(grad.index(), l));
+    registerGrad(m_module->m_exprs.at(l).get(), new MulExpr(grad.index(), fwd(r)));
+    registerGrad(m_module->m_exprs.at(r).get(), new MulExpr(grad.index(), fwd(l)));
   }
 
   void visit(const OutputExpr&) override { assert(false); /* technically should be unreachable */ }
@@ -218,6 +378,10 @@ public:
 protected:
   void registerGrad(const Expr* expr, Value value)
   {
+    if (m_pruned.count(expr) != 0) {
+      return;
+    }
+
     auto it = m_gradMap.find(expr);
 
     if (it == m_gradMap.end()) {
@@ -230,6 +394,13 @@ protected:
 
   [[nodiscard]] auto findGrad(const Expr* expr) -> Value { return m_gradMap.at(expr); }
 
+  /* Maps a forward value to its recomputed copy, if the current segment was recomputed. */
+  [[nodiscard]] auto fwd(const uint32_t index) const -> uint32_t
+  {
+    const auto it = m_forward.find(index);
+    return (it != m_forward.end()) ? it->second : index;
+  }
+
   [[nodiscard]] auto push(Expr* e) -> Value
   {
     std::unique_ptr<Expr> tmp(e);
@@ -243,6 +414,204 @@ private:
   ModuleImpl* m_module;
 
   std::map<const Expr*, Value> m_gradMap;
+
+  std::set<const Expr*> m_pruned;
+
+  std::map<uint32_t, uint32_t> m_forward;
+
+  bool m_collectParamGrads{ false };
+
+  std::map<uint32_t, uint32_t> m_paramGrads;
+};
+
+/* Propagates tangents through the expressions, in forward order. Expressions without a tangent have a tangent of
+ * zero, which is never materialized.
+ * */
+class JvpModuleInserter final : public ExprVisitor
+{
+public:
+  explicit JvpModuleInserter(ModuleImpl* m)
+    : m_module(m)
+  {
+  }
+
+  void setTangent(const uint32_t index, const uint32_t tangent) { m_tangents[index] = tangent; }
+
+  /**
+   * @brief Gets the tangent of an expression, which is created as a zero constant if the expression has none.
+   * */
+  [[nodiscard]] auto tangentOrZero(const uint32_t index) -> uint32_t
+  {
+    const auto it = m_tangents.find(index);
+    if (it != m_tangents.end()) {
+      return it->second;
+    }
+    return zero();
+  }
+
+  [[nodiscard]] auto zero() -> uint32_t { return push(new ConstExpr(0.0F)); }
+
+  void visit(const InputExpr&) override { next(); }
+
+  void visit(const ParamExpr&) override { next(); }
+
+  void visit(const ConstExpr&) override { next(); }
+
+  void visit(const NegateExpr& e) override
+  {
+    unary(e, [this](const uint32_t t, uint32_t) { return push(new NegateExpr(t)); });
+  }
+
+  void visit(const RcpExpr& e) override
+  {
+    unary(e, [this](const uint32_t t, const uint32_t self) {
+      const auto sq = push(new MulExpr(self, self));
+      const auto negSq = push(new NegateExpr(sq));
+      return push(new MulExpr(t, negSq));
+    });
+  }
+
+  void visit(const SqrtExpr& e) override
+  {
+    unary(e, [this](const uint32_t t, const uint32_t self) {
+      const auto half = push(new ConstExpr(0.5F));
+      const auto rs = push(new RcpExpr(self));
+      const auto coeff = push(new MulExpr(half, rs));
+      return push(new MulExpr(t, coeff));
+    });
+  }
+
+  void visit(const ExpExpr& e) override
+  {
+    unary(e, [this](const uint32_t t, const uint32_t self) { return push(new MulExpr(t, self)); });
+  }
+
+  void visit(const ReLUExpr& e) override
+  {
+    unary(e, [this, &e](const uint32_t t, uint32_t) {
+      const auto mask = push(new HeavisideExpr(e.operand()));
+      return push(new MulExpr(t, mask));
+    });
+  }
+
+  void visit(const SigmoidExpr& e) override
+  {
+    unary(e, [this](const uint32_t t, const uint32_t self) {
+      const auto k = push(new ConstExpr(1.0F));
+      const auto x0 = push(new SubExpr(k, self));
+      const auto x1 = push(new MulExpr(self, x0));
+      return push(new MulExpr(t, x1));
+    });
+  }
+
+  void visit(const HeavisideExpr&) override { next(); }
+
+  void visit(const SinExpr& e) override
+  {
+    unary(e, [this, &e](const uint32_t t, uint32_t) {
+      const auto c = push(new CosExpr(e.operand()));
+      return push(new MulExpr(t, c));
+    });
+  }
+
+  void visit(const CosExpr& e) override
+  {
+    unary(e, [this, &e](const uint32_t t, uint32_t) {
+      const auto s = push(new SinExpr(e.operand()));
+      const auto sNeg = push(new NegateExpr(s));
+      return push(new MulExpr(t, sNeg));
+    });
+  }
+
+  void visit(const CheckpointExpr& e) override
+  {
+    unary(e, [](const uint32_t t, uint32_t) { return t; });
+  }
+
+  void visit(const AddExpr& e) override
+  {
+    const auto self = next();
+    const auto l = find(e.left());
+    const auto r = find(e.right());
+    if (l && r) {
+      m_tangents[self] = push(new AddExpr(*l, *r));
+    } else if (l || r) {
+      m_tangents[self] = l ? *l : *r;
+    }
+  }
+
+  void visit(const SubExpr& e) override
+  {
+    const auto self = next();
+    const auto l = find(e.left());
+    const auto r = find(e.right());
+    if (l && r) {
+      m_tangents[self] = push(new SubExpr(*l, *r));
+    } else if (l) {
+      m_tangents[self] = *l;
+    } else if (r) {
+      m_tangents[self] = push(new NegateExpr(*r));
+    }
+  }
+
+  void visit(const MulExpr& e) override
+  {
+    const auto self = next();
+    const auto l = find(e.left());
+    const auto r = find(e.right());
+    std::optional<uint32_t> tangent;
+    if (l) {
+      tangent = push(new MulExpr(*l, e.right()));
+    }
+    if (r) {
+      const auto term = push(new MulExpr(e.left(), *r));
+      tangent = tangent ? push(new AddExpr(*tangent, term)) : term;
+    }
+    if (tangent) {
+      m_tangents[self] = *tangent;
+    }
+  }
+
+  void visit(const OutputExpr&) override { next(); }
+
+protected:
+  /* Returns the index of the expression that is being visited. */
+  auto next() -> uint32_t { return m_counter++; }
+
+  [[nodiscard]] auto find(const uint32_t index) const -> std::optional<uint32_t>
+  {
+    const auto it = m_tangents.find(index);
+    if (it == m_tangents.end()) {
+      return std::nullopt;
+    }
+    return it->second;
+  }
+
+  /* Applies the chain rule to a unary expression. The rule is called with the tangent of the operand and the index
+   * of the expression itself, and returns the tangent of the expression. */
+  template<typename Rule>
+  void unary(const UnaryExpr& e, Rule rule)
+  {
+    const auto self = next();
+    const auto t = find(e.operand());
+    if (t) {
+      m_tangents[self] = rule(*t, self);
+    }
+  }
+
+  [[nodiscard]] auto push(Expr* e) -> uint32_t
+  {
+    m_module->m_exprs.emplace_back(e);
+
+    return static_cast<uint32_t>(m_module->m_exprs.size() - 1);
+  }
+
+private:
+  ModuleImpl* m_module;
+
+  uint32_t m_counter{};
+
+  std::map<uint32_t, uint32_t> m_tangents;
 };
 
 class ModuleBuilderImpl final : public ModuleBuilder
@@ -260,33 +629,206 @@ public:
     return result;
   }
 
-  [[nodiscard]] auto buildWithGrad(const Value loss) -> std::unique_ptr<Module> override
+  [[nodiscard]] auto buildWithGrad(const std::vector<Value>& losses,
+                                   const std::vector<Value>& auxOutputs,
+                                   const uint32_t checkpointSegments) -> std::unique_ptr<Module> override
   {
+    if (losses.empty()) {
+      throw Exception("the grad module needs at least one loss");
+    }
+
+    const auto numLosses = static_cast<uint32_t>(losses.size());
+
     auto m = std::make_unique<ModuleImpl>(*m_module);
 
-    m->m_numOutputs = m->m_numParameters;
+    m->m_numOutputs = m->m_numParameters + numLosses + static_cast<uint32_t>(auxOutputs.size());
 
     GradModuleInserter g(m.get());
 
-    // Seed the auto grad algorithm
-    g.registerGrad(m->m_exprs.at(loss.index()).get(), new ConstExpr(1.0F));
+    const auto active = findActive(losses, /*includeFrozen=*/false);
+
+    g.prune(active);
+
+    uint32_t last{};
+
+    // Seed the auto grad algorithm. Multiple losses are seeded with their weights, which are passed in as extra
+    // inputs, so that one reverse sweep computes the weighted sum of their gradients.
+    for (const auto& loss : losses) {
+      if (numLosses == 1) {
+        g.registerGrad(m->m_exprs.at(loss.index()).get(), new ConstExpr(1.0F));
+      } else {
+        g.registerGrad(m->m_exprs.at(loss.index()).get(), new InputExpr(m->m_numInputs++));
+      }
+      last = std::max(last, loss.index());
+    }
 
     // NOTE: Do not use the module copy, in case the fact that we are appending to it
     //       causes problems.
-    m_module->reverseVisitFrom(g, loss.index());
+    if ((checkpointSegments > 1) || !m_checkpointMarks.empty()) {
+      reverseVisitCheckpointed(g, last, checkpointSegments, active);
+    } else {
+      reverseVisitActive(g, last, active);
+    }
+
+    outputInactiveGrads(m.get(), active);
+
+    for (uint32_t i = 0; i < numLosses; i++) {
+      m->m_exprs.emplace_back(new OutputExpr(m->m_numParameters + i, losses[i].index()));
+    }
+
+    for (size_t i = 0; i < auxOutputs.size(); i++) {
+      m->m_exprs.emplace_back(new OutputExpr(m->m_numParameters + numLosses + i, auxOutputs[i].index()));
+    }
+
+    return m;
+  }
+
+  [[nodiscard]] auto buildBackward(const std::vector<Value>& outputs) -> std::unique_ptr<Module> override
+  {
+    auto m = std::make_unique<ModuleImpl>(*m_module);
+
+    m->m_numOutputs = m->m_numParameters;
+
+    GradModuleInserter g(m.get());
+
+    const auto active = findActive(outputs, /*includeFrozen=*/false);
+
+    g.prune(active);
+
+    uint32_t last{};
+
+    // Seed the auto grad algorithm with the gradients of the outputs, which are passed in as extra inputs.
+    for (const auto& output : outputs) {
+      g.registerGrad(m->m_exprs.at(output.index()).get(), new InputExpr(m->m_numInputs++));
+      last = std::max(last, output.index());
+    }
+
+    reverseVisitActive(g, last, active);
+
+    outputInactiveGrads(m.get(), active);
+
+    return m;
+  }
+
+  [[nodiscard]] auto buildJvp(const std::vector<Value>& outputs, const std::vector<Value>& tangentInputs)
+    -> std::unique_ptr<Module> override
+  {
+    auto m = std::make_unique<ModuleImpl>(*m_module);
+
+    m->m_numOutputs = static_cast<uint32_t>(outputs.size());
+
+    JvpModuleInserter j(m.get());
+
+    // Seed the tangents of the selected inputs, which are passed in as extra inputs.
+    for (const auto& input : tangentInputs) {
+      if (dynamic_cast<const InputExpr*>(m_module->m_exprs.at(input.index()).get()) == nullptr) {
+        throw Exception("tangents can only be seeded at inputs");
+      }
+      m->m_exprs.emplace_back(new InputExpr(m->m_numInputs++));
+      j.setTangent(input.index(), static_cast<uint32_t>(m->m_exprs.size() - 1));
+    }
+
+    // NOTE: Do not use the module copy, since it is being appended to.
+    m_module->visit(j);
+
+    for (size_t i = 0; i < outputs.size(); i++) {
+      const auto tangent = j.tangentOrZero(outputs[i].index());
+      m->m_exprs.emplace_back(new OutputExpr(i, tangent));
+    }
+
+    return m;
+  }
+
+  [[nodiscard]] auto buildHvp(const Value loss) -> std::unique_ptr<Module> override
+  {
+    auto m = std::make_unique<ModuleImpl>(*m_module);
+
+    m->m_numOutputs = m->m_numParameters;
+
+    GradModuleInserter g(m.get());
+    g.collectParamGrads();
+    const auto active = findActive({ loss }, /*includeFrozen=*/true);
+    g.prune(active);
+    g.registerGrad(m->m_exprs.at(loss.index()).get(), new ConstExpr(1.0F));
+    reverseVisitActive(g, loss.index(), active);
+
+    // Forward mode over the gradient computation, with the tangent of each parameter read from the vector.
+    JvpModuleInserter j(m.get());
+
+    for (uint32_t i = 0; i < m_module->m_exprs.size(); i++) {
+      const auto* param = dynamic_cast<const ParamExpr*>(m_module->m_exprs[i].get());
+      if (param != nullptr) {
+        m->m_exprs.emplace_back(new InputExpr(m->m_numInputs + param->index()));
+        j.setTangent(i, static_cast<uint32_t>(m->m_exprs.size() - 1));
+      }
+    }
+
+    m->m_numInputs += m->m_numParameters;
+
+    // NOTE: Visit a snapshot, since the module is being appended to.
+    const ModuleImpl reverse(*m);
+    reverse.visit(j);
+
+    for (uint32_t i = 0; i < m->m_numParameters; i++) {
+      const auto grad = g.paramGrads().find(i);
+      const auto product = (grad != g.paramGrads().end()) ? j.tangentOrZero(grad->second) : j.zero();
+      m->m_exprs.emplace_back(new OutputExpr(i, product));
+    }
 
     return m;
   }
 
-  [[nodiscard]] auto input() -> Value override { return push(new InputExpr(m_module->m_numInputs++)); }
+  [[nodiscard]] auto input(const std::string_view& group) -> Value override
+  {
+    return push(new InputExpr(m_module->m_numInputs++, group));
+  }
 
-  [[nodiscard]] auto param(const std::string_view& name) -> Value override
+  void freeze(const std::string_view& name) override
+  {
+    // The elements of an array are created one after the other, so the group ends at this parameter index.
+    uint32_t groupEnd{};
+
+    bool found = false;
+
+    for (auto& expr : m_module->m_exprs) {
+      const auto* param = dynamic_cast<const ParamExpr*>(expr.get());
+      if (param == nullptr) {
+        continue;
+      }
+      if (!param->name().empty() && (param->name() == name)) {
+        groupEnd = param->index() + m_paramArrays.at(param->index());
+      }
+      if (param->index() < groupEnd) {
+        // Modules that were already built keep sharing the original expression.
+        expr = std::make_shared<ParamExpr>(param->index(), param->name(), /*frozen=*/true);
+        found = true;
+      }
+    }
+
+    if (!found) {
+      throw Exception("no parameter is named \"" + std::string(name) + "\"");
+    }
+  }
+
+  void markCheckpoint() override
+  {
+    const auto boundary = static_cast<uint32_t>(m_module->m_exprs.size());
+    if (m_checkpointMarks.empty() || (m_checkpointMarks.back() != boundary)) {
+      m_checkpointMarks.emplace_back(boundary);
+    }
+  }
+
+  [[nodiscard]] auto param(const std::string_view& name, const uint32_t size, const bool frozen) -> Value override
   {
     const uint32_t param = m_module->m_numParameters;
 
     m_module->m_numParameters++;
 
-    return push(new ParamExpr(param, name));
+    if (!name.empty()) {
+      m_paramArrays.emplace(param, size);
+    }
+
+    return push(new ParamExpr(param, name, frozen));
   }
 
   [[nodiscard]] auto constant(const float value) -> Value override { return push(new ConstExpr(value)); }
@@ -324,6 +866,113 @@ public:
   }
 
 protected:
+  /* Finds the expressions that need a gradient, which are the ones that both depend on a parameter being trained and
+   * contribute to one of the roots. Everything else either only flows into inputs, constants or frozen parameters, or
+   * is a side computation (such as an eval-only head) that the roots do not depend on.
+   * */
+  [[nodiscard]] auto findActive(const std::vector<Value>& roots, const bool includeFrozen) const -> std::vector<bool>
+  {
+    const auto nodes = analyzeModule(*m_module);
+
+    std::vector<bool> seeds(nodes.size(), false);
+    for (size_t i = 0; i < nodes.size(); i++) {
+      seeds[i] = (nodes[i].kind == ExprNode::Kind::param) && (includeFrozen || !nodes[i].frozen);
+    }
+
+    auto active = findDependents(nodes, std::move(seeds));
+
+    std::vector<uint32_t> rootIndices;
+    for (const auto& root : roots) {
+      rootIndices.emplace_back(root.index());
+    }
+
+    const auto cone = findCone(nodes, rootIndices);
+    for (size_t i = 0; i < active.size(); i++) {
+      active[i] = active[i] && cone[i];
+    }
+
+    return active;
+  }
+
+  /* Frozen parameters, and parameters that do not contribute to the roots, are skipped by the reverse sweep. Their
+   * gradients are still output, as zero, so that the gradient buffer keeps one element per parameter.
+   * */
+  void outputInactiveGrads(ModuleImpl* m, const std::vector<bool>& active) const
+  {
+    uint32_t zero{ UINT32_MAX };
+
+    for (size_t i = 0; i < active.size(); i++) {
+      const auto* param = dynamic_cast<const ParamExpr*>(m_module->m_exprs[i].get());
+      if ((param == nullptr) || active[i]) {
+        continue;
+      }
+      if (zero == UINT32_MAX) {
+        m->m_exprs.emplace_back(new ConstExpr(0.0F));
+        zero = static_cast<uint32_t>(m->m_exprs.size() - 1);
+      }
+      m->m_exprs.emplace_back(new OutputExpr(param->index(), zero));
+    }
+  }
+
+  /* Like reverseVisitFrom, but only visits the active expressions. See GradModuleInserter::prune. */
+  void reverseVisitActive(GradModuleInserter& g, const uint32_t last, const std::vector<bool>& active)
+  {
+    for (uint32_t i = last + 1; i > 0; i--) {
+      if (active[i - 1]) {
+        m_module->m_exprs[i - 1]->accept(g);
+      }
+    }
+  }
+
+  /* Like reverseVisitActive, but recomputes each segment of the forward pass (except the last one, which is still
+   * live) right before the reverse sweep enters it. The segments are split at the marked checkpoints if there are any,
+   * and have about the same number of active expressions otherwise.
+   * */
+  void reverseVisitCheckpointed(GradModuleInserter& g,
+                                const uint32_t last,
+                                const uint32_t numSegments,
+                                const std::vector<bool>& active)
+  {
+    const auto nodes = analyzeModule(*m_module);
+
+    std::vector<bool> isConstant(nodes.size(), false);
+    std::vector<uint32_t> computed;
+    for (uint32_t i = 0; i <= last; i++) {
+      isConstant[i] = (nodes[i].kind == ExprNode::Kind::constant);
+      if (nodes[i].computed() && active[i]) {
+        computed.emplace_back(i);
+      }
+    }
+
+    const auto& marks = m_checkpointMarks;
+
+    std::vector<std::vector<uint32_t>> segments(marks.empty() ? numSegments : (marks.size() + 1));
+    for (size_t i = 0; i < computed.size(); i++) {
+      const auto s = marks.empty() ? ((i * numSegments) / computed.size())
+                                   : static_cast<size_t>(std::upper_bound(marks.begin(), marks.end(), computed[i]) -
+                                                         marks.begin());
+      segments[s].emplace_back(computed[i]);
+    }
+
+    // Marks that are next to each other, or after the loss, leave segments empty.
+    std::erase_if(segments, [](const std::vector<uint32_t>& segment) { return segment.empty(); });
+
+    std::map<uint32_t, size_t> segmentEnds;
+    for (size_t s = 0; (s + 1) < segments.size(); s++) {
+      segmentEnds.emplace(segments[s].back(), s);
+    }
+
+    for (uint32_t i = last + 1; i > 0; i--) {
+      const auto segment = segmentEnds.find(i - 1);
+      if (segment != segmentEnds.end()) {
+        g.recompute(segments[segment->second], isConstant);
+      }
+      if (active[i - 1]) {
+        m_module->m_exprs[i - 1]->accept(g);
+      }
+    }
+  }
+
   template<typename DerivedExpr>
   [[nodiscard]] auto push(DerivedExpr* expr) -> Value
   {
@@ -338,6 +987,12 @@ protected:
 
 private:
   std::unique_ptr<ModuleImpl> m_module{ new ModuleImpl() };
+
+  /* The number of elements of the array that each named parameter is the first element of. */
+  std::map<uint32_t, uint32_t> m_paramArrays;
+
+  /* The index of the first expression after each boundary marked with markCheckpoint, in ascending order. */
+  std::vector<uint32_t> m_checkpointMarks;
 };
 
 } // namespace
@@ -0,0 +1,194 @@
+#include "module_analysis.hpp"
+
+#include <axon/expr.hpp>
+#include <axon/expr_visitor.hpp>
+#include <axon/module.hpp>
+
+#include <algorithm>
+
+namespace axon {
+
+namespace {
+
+class NodeCollector final : public ExprVisitor
+{
+public:
+  explicit NodeCollector(std::vector<ExprNode>* nodes)
+    : m_nodes(nodes)
+  {
+  }
+
+  void visit(const InputExpr& e) override { addLeaf(ExprNode::Kind::input, e.index()); }
+
+  void visit(const ParamExpr& e) override
+  {
+    addLeaf(ExprNode::Kind::param, e.index());
+    m_nodes->back().frozen = e.frozen();
+  }
+
+  void visit(const ConstExpr&) override { addLeaf(ExprNode::Kind::constant, 0); }
+
+  void visit(const NegateExpr& e) override { addUnary(e); }
+
+  void visit(const RcpExpr& e) override { addUnary(e); }
+
+  void visit(const SqrtExpr& e) override { addUnary(e); }
+
+  void visit(const ExpExpr& e) override { addUnary(e); }
+
+  void visit(const ReLUExpr& e) override { addUnary(e); }
+
+  void visit(const SigmoidExpr& e) override { addUnary(e); }
+
+  void visit(const HeavisideExpr& e) override { addUnary(e); }
+
+  void visit(const SinExpr& e) override { addUnary(e); }
+
+  void visit(const CosExpr& e) override { addUnary(e); }
+
+  void visit(const CheckpointExpr& e) override { addUnary(e); }
+
+  void visit(const AddExpr& e) override { addBinary(e); }
+
+  void visit(const SubExpr& e) override { addBinary(e); }
+
+  void visit(const MulExpr& e) override { addBinary(e); }
+
+  void visit(const OutputExpr& e) override
+  {
+    ExprNode node;
+    node.kind = ExprNode::Kind::output;
+    node.operands[0] = e.valueIndex();
+    node.numOperands = 1;
+    node.index = e.outputIndex();
+    m_nodes->emplace_back(node);
+  }
+
+protected:
+  void addLeaf(const ExprNode::Kind kind, const uint32_t index)
+  {
+    ExprNode node;
+    node.kind = kind;
+    node.index = index;
+    m_nodes->emplace_back(node);
+  }
+
+  void addUnary(const UnaryExpr& e)
+  {
+    ExprNode node;
+    node.kind = ExprNode::Kind::unary;
+    node.operands[0] = e.operand();
+    node.numOperands = 1;
+    m_nodes->emplace_back(node);
+  }
+
+  void addBinary(const BinaryExpr& e)
+  {
+    ExprNode node;
+    node.kind = ExprNode::Kind::binary;
+    node.operands[0] = e.left();
+    node.operands[1] = e.right();
+    node.numOperands = 2;
+    m_nodes->emplace_back(node);
+  }
+
+private:
+  std::vector<ExprNode>* m_nodes;
+};
+
+} // namespace
+
+auto
+analyzeModule(const Module& module) -> std::vector<ExprNode>
+{
+  std::vector<ExprNode> nodes;
+  nodes.reserve(module.numExprs());
+  NodeCollector collector(&nodes);
+  module.visit(collector);
+  return nodes;
+}
+
+auto
+findDependents(const std::vector<ExprNode>& nodes, std::vector<bool> seeds) -> std::vector<bool>
+{
+  seeds.resize(nodes.size(), false);
+
+  // operands always come before the expressions that use them, so one forward pass is enough
+  for (size_t i = 0; i < nodes.size(); i++) {
+    for (uint32_t j = 0; j < nodes[i].numOperands; j++) {
+      if (seeds[nodes[i].operands[j]]) {
+        seeds[i] = true;
+      }
+    }
+  }
+
+  return seeds;
+}
+
+auto
+findCone(const std::vector<ExprNode>& nodes, const std::vector<uint32_t>& roots) -> std::vector<bool>
+{
+  std::vector<bool> cone(nodes.size(), false);
+
+  for (const auto root : roots) {
+    cone.at(root) = true;
+  }
+
+  for (size_t i = nodes.size(); i > 0; i--) {
+    const auto& node = nodes[i - 1];
+    if (!cone[i - 1]) {
+      continue;
+    }
+    for (uint32_t j = 0; j < node.numOperands; j++) {
+      cone[node.operands[j]] = true;
+    }
+  }
+
+  return cone;
+}
+
+auto
+countUses(const std::vector<ExprNode>& nodes) -> std::vector<uint32_t>
+{
+  std::vector<uint32_t> uses(nodes.size(), 0);
+
+  for (const auto& node : nodes) {
+    for (uint32_t j = 0; j < node.numOperands; j++) {
+      uses[node.operands[j]]++;
+    }
+  }
+
+  return uses;
+}
+
+auto
+peakLiveValues(const std::vector<ExprNode>& nodes) -> uint32_t
+{
+  std::vector<size_t> lastUse(nodes.size());
+  for (size_t i = 0; i < nodes.size(); i++) {
+    lastUse[i] = i;
+    for (uint32_t j = 0; j < nodes[i].numOperands; j++) {
+      lastUse[nodes[i].operands[j]] = i;
+    }
+  }
+
+  // The change in the number of live values at each expression.
+  std::vector<int64_t> delta(nodes.size() + 1, 0);
+  for (size_t i = 0; i < nodes.size(); i++) {
+    if (nodes[i].computed()) {
+      delta[i]++;
+      delta[lastUse[i] + 1]--;
+    }
+  }
+
+  int64_t live{};
+  int64_t peak{};
+  for (const auto d : delta) {
+    live += d;
+    peak = std::max(peak, live);
+  }
+
+  return static_cast<uint32_t>(peak);
+}
+
+} // namespace axon
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+
+#include <stdint.h>
+
+namespace axon {
+
+class Module;
+
+/**
+ * @brief A summary of one expression, for passes that only need the structure of a module.
+ * */
+struct ExprNode final
+{
+  enum class Kind
+  {
+    input,
+    param,
+    constant,
+    unary,
+    binary,
+    output
+  };
+
+  Kind kind{ Kind::constant };
+
+  /**
+   * @brief The operands of unary and binary expressions, or the value of an output expression.
+   * */
+  uint32_t operands[2]{};
+
+  uint32_t numOperands{};
+
+  /**
+   * @brief The input index, parameter index or output index, depending on the kind of expression.
+   * */
+  uint32_t index{};
+
+  /**
+   * @brief Whether a parameter is frozen, see ParamExpr::frozen.
+   * */
+  bool frozen{ false };
+
+  [[nodiscard]] auto computed() const -> bool { return (kind == Kind::unary) || (kind == Kind::binary); }
+};
+
+/**
+ * @brief Summarizes every expression of a module, in order.
+ * */
+[[nodiscard]] auto
+analyzeModule(const Module& module) -> std::vector<ExprNode>;
+
+/**
+ * @brief Finds every expression that is either a seed or has an operand which (transitively) depends on a seed.
+ * */
+[[nodiscard]] auto
+findDependents(const std::vector<ExprNode>& nodes, std::vector<bool> seeds) -> std::vector<bool>;
+
+/**
+ * @brief Finds every expression that is needed to compute the given roots, including the roots themselves.
+ * */
+[[nodiscard]] auto
+findCone(const std::vector<ExprNode>& nodes, const std::vector<uint32_t>& roots) -> std::vector<bool>;
+
+/**
+ * @brief Counts how many times each expression is used as an operand.
+ * */
+[[nodiscard]] auto
+countUses(const std::vector<ExprNode>& nodes) -> std::vector<uint32_t>;
+
+/**
+ * @brief Finds the largest number of computed values that are live at the same time, when the expressions are
+ *        evaluated in order. A value is live from the expression that computes it to its last use.
+ * */
+[[nodiscard]] auto
+peakLiveValues(const std::vector<ExprNode>& nodes) -> uint32_t;
+
+} // namespace axon
@@ -0,0 +1,485 @@
+#include <axon/module.hpp>
+
+#include <axon/exception.hpp>
+#include <axon/expr.hpp>
+#include <axon/expr_visitor.hpp>
+
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define AXON_MODULE_FILE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define AXON_MODULE_FILE_MMAP 0
+#endif
+
+namespace axon {
+
+namespace {
+
+/* The layout of a module file is a header, followed by one record per expression (in evaluation order) and then a
+ * table with the names of the parameters and input groups. Everything is stored in native byte order, which is
+ * checked with the byte order field of the header.
+ * */
+
+constexpr char fileMagic[8] = { 'A', 'X', 'O', 'N', 'M', 'O', 'D', '\0' };
+
+constexpr uint32_t fileVersion = 1;
+
+constexpr uint32_t fileByteOrder = 0x01020304U;
+
+struct FileHeader final
+{
+  char magic[8];
+
+  uint32_t version;
+
+  uint32_t byteOrder;
+
+  uint32_t numParameters;
+
+  uint32_t numInputs;
+
+  uint32_t numOutputs;
+
+  uint32_t numExprs;
+
+  uint32_t stringsSize;
+
+  uint32_t reserved;
+};
+
+/* The opcodes are part of the file format, so existing values must never change. */
+enum class Opcode : uint8_t
+{
+  input = 1,
+  param = 2,
+  constant = 3,
+  negate = 4,
+  rcp = 5,
+  sqrt = 6,
+  exp = 7,
+  relu = 8,
+  sigmoid = 9,
+  heaviside = 10,
+  sin = 11,
+  cos = 12,
+  add = 13,
+  sub = 14,
+  mul = 15,
+  output = 16,
+  checkpoint = 17
+};
+
+constexpr uint8_t frozenFlag = 1;
+
+/* Inputs and parameters store their index in a, and their group or name as an offset (b) and a size (c) in the string
+ * table. Constants store the bits of their value in a. Unary and binary expressions store their operands in a and b,
+ * and outputs store their output index in a and their value in b.
+ * */
+struct FileRecord final
+{
+  uint8_t opcode;
+
+  uint8_t flags;
+
+  uint16_t reserved;
+
+  uint32_t a;
+
+  uint32_t b;
+
+  uint32_t c;
+};
+
+static_assert(sizeof(FileHeader) == 40);
+
+static_assert(sizeof(FileRecord) == 16);
+
+class RecordWriter final : public ExprVisitor
+{
+public:
+  [[nodiscard]] auto records() const -> const std::vector<FileRecord>& { return m_records; }
+
+  [[nodiscard]] auto strings() const -> const std::string& { return m_strings; }
+
+  void visit(const InputExpr& e) override { addNamed(Opcode::input, 0, e.index(), e.group()); }
+
+  void visit(const ParamExpr& e) override
+  {
+    addNamed(Opcode::param, e.frozen() ? frozenFlag : 0, e.index(), e.name());
+  }
+
+  void visit(const ConstExpr& e) override
+  {
+    const auto value = e.value();
+    uint32_t bits{};
+    memcpy(&bits, &value, sizeof(bits));
+    add(Opcode::constant, 0, bits, 0, 0);
+  }
+
+  void visit(const NegateExpr& e) override { add(Opcode::negate, 0, e.operand(), 0, 0); }
+
+  void visit(const RcpExpr& e) override { add(Opcode::rcp, 0, e.operand(), 0, 0); }
+
+  void visit(const SqrtExpr& e) override { add(Opcode::sqrt, 0, e.operand(), 0, 0); }
+
+  void visit(const ExpExpr& e) override { add(Opcode::exp, 0, e.operand(), 0, 0); }
+
+  void visit(const ReLUExpr& e) override { add(Opcode::relu, 0, e.operand(), 0, 0); }
+
+  void visit(const SigmoidExpr& e) override { add(Opcode::sigmoid, 0, e.operand(), 0, 0); }
+
+  void visit(const HeavisideExpr& e) override { add(Opcode::heaviside, 0, e.operand(), 0, 0); }
+
+  void visit(const SinExpr& e) override { add(Opcode::sin, 0, e.operand(), 0, 0); }
+
+  void visit(const CosExpr& e) override { add(Opcode::cos, 0, e.operand(), 0, 0); }
+
+  void visit(const CheckpointExpr& e) override { add(Opcode::checkpoint, 0, e.operand(), 0, 0); }
+
+  void visit(const AddExpr& e) override { add(Opcode::add, 0, e.left(), e.right(), 0); }
+
+  void visit(const SubExpr& e) override { add(Opcode::sub, 0, e.left(), e.right(), 0); }
+
+  void visit(const MulExpr& e) override { add(Opcode::mul, 0, e.left(), e.right(), 0); }
+
+  void visit(const OutputExpr& e) override { add(Opcode::output, 0, e.outputIndex(), e.valueIndex(), 0); }
+
+protected:
+  void add(const Opcode opcode, const uint8_t flags, const uint32_t a, const uint32_t b, const uint32_t c)
+  {
+    m_records.emplace_back(FileRecord{ static_cast<uint8_t>(opcode), flags, 0, a, b, c });
+  }
+
+  void addNamed(const Opcode opcode, const uint8_t flags, const uint32_t index, const std::string_view& name)
+  {
+    add(opcode, flags, index, static_cast<uint32_t>(m_strings.size()), static_cast<uint32_t>(name.size()));
+    m_strings.append(name);
+  }
+
+private:
+  std::vector<FileRecord> m_records;
+
+  std::string m_strings;
+};
+
+/* Owns the contents of a module file. It is shared by the copies of a mapped module. On POSIX systems the file is
+ * mapped into memory, and elsewhere it is read into a buffer.
+ * */
+class FileMapping final
+{
+public:
+  explicit FileMapping(const std::filesystem::path& path);
+
+  FileMapping(const FileMapping&) = delete;
+
+  ~FileMapping();
+
+  [[nodiscard]] auto bytes() const -> const uint8_t* { return static_cast<const uint8_t*>(m_data); }
+
+  [[nodiscard]] auto size() const -> size_t { return m_size; }
+
+private:
+  const void* m_data{ nullptr };
+
+  size_t m_size{};
+
+  std::vector<uint64_t> m_buffer;
+};
+
+#if AXON_MODULE_FILE_MMAP
+
+FileMapping::FileMapping(const std::filesystem::path& path)
+{
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw Exception("failed to open module file \"" + path.string() + "\"");
+  }
+
+  struct stat info{};
+  if ((fstat(fd, &info) != 0) || (static_cast<size_t>(info.st_size) < sizeof(FileHeader))) {
+    close(fd);
+    throw Exception("module file \"" + path.string() + "\" is too small");
+  }
+
+  const auto size = static_cast<size_t>(info.st_size);
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw Exception("failed to map module file \"" + path.string() + "\"");
+  }
+
+  m_data = data;
+  m_size = size;
+}
+
+FileMapping::~FileMapping()
+{
+  munmap(const_cast<void*>(m_data), m_size);
+}
+
+#else
+
+FileMapping::FileMapping(const std::filesystem::path& path)
+{
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file) {
+    throw Exception("failed to open module file \"" + path.string() + "\"");
+  }
+
+  const auto size = static_cast<size_t>(file.tellg());
+  if (size < sizeof(FileHeader)) {
+    throw Exception("module file \"" + path.string() + "\" is too small");
+  }
+
+  // The buffer is made of 64-bit words, so that the records are aligned like they are in a mapping.
+  m_buffer.resize((size + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+  file.seekg(0);
+  if (!file.read(reinterpret_cast<char*>(m_buffer.data()), static_cast<std::streamsize>(size))) {
+    throw Exception("failed to read module file \"" + path.string() + "\"");
+  }
+
+  m_data = m_buffer.data();
+  m_size = size;
+}
+
+FileMapping::~FileMapping() = default;
+
+#endif
+
+/* A read-only module that decodes its expressions from a mapped file as they are visited, instead of keeping an
+ * expression object for each one.
+ * */
+class MappedModule final : public Module
+{
+public:
+  explicit MappedModule(std::shared_ptr<const FileMapping> mapping)
+    : m_mapping(std::move(mapping))
+  {
+    memcpy(&m_header, m_mapping->bytes(), sizeof(m_header));
+    m_records = reinterpret_cast<const FileRecord*>(m_mapping->bytes() + sizeof(FileHeader));
+    m_strings = reinterpret_cast<const char*>(m_records + m_header.numExprs);
+  }
+
+  [[nodiscard]] auto copy() const -> std::unique_ptr<Module> override { return std::make_unique<MappedModule>(*this); }
+
+  void visit(ExprVisitor& visitor) const override
+  {
+    for (uint32_t i = 0; i < m_header.numExprs; i++) {
+      decode(m_records[i], visitor);
+    }
+  }
+
+  void reverseVisit(ExprVisitor& visitor) const override
+  {
+    for (uint32_t i = m_header.numExprs; i > 0; i--) {
+      decode(m_records[i - 1], visitor);
+    }
+  }
+
+  void reverseVisitFrom(ExprVisitor& visitor, const uint32_t startOffset) const override
+  {
+    for (uint32_t i = startOffset + 1; i > 0; i--) {
+      decode(m_records[i - 1], visitor);
+    }
+  }
+
+  [[nodiscard]] auto numParameters() const -> uint32_t override { return m_header.numParameters; }
+
+  [[nodiscard]] auto numInputs() const -> uint32_t override { return m_header.numInputs; }
+
+  [[nodiscard]] auto numExprs() const -> uint32_t override { return m_header.numExprs; }
+
+  [[nodiscard]] auto numOutputs() const -> uint32_t override { return m_header.numOutputs; }
+
+protected:
+  void decode(const FileRecord& r, ExprVisitor& visitor) const
+  {
+    switch (static_cast<Opcode>(r.opcode)) {
+      case Opcode::input:
+        InputExpr(r.a, std::string_view(m_strings + r.b, r.c)).accept(visitor);
+        break;
+      case Opcode::param:
+        ParamExpr(r.a, std::string_view(m_strings + r.b, r.c), (r.flags & frozenFlag) != 0).accept(visitor);
+        break;
+      case Opcode::constant: {
+        float value{};
+        memcpy(&value, &r.a, sizeof(value));
+        ConstExpr(value).accept(visitor);
+      } break;
+      case Opcode::negate:
+        NegateExpr(r.a).accept(visitor);
+        break;
+      case Opcode::rcp:
+        RcpExpr(r.a).accept(visitor);
+        break;
+      case Opcode::sqrt:
+        SqrtExpr(r.a).accept(visitor);
+        break;
+      case Opcode::exp:
+        ExpExpr(r.a).accept(visitor);
+        break;
+      case Opcode::relu:
+        ReLUExpr(r.a).accept(visitor);
+        break;
+      case Opcode::sigmoid:
+        SigmoidExpr(r.a).accept(visitor);
+        break;
+      case Opcode::heaviside:
+        HeavisideExpr(r.a).accept(visitor);
+        break;
+      case Opcode::sin:
+        SinExpr(r.a).accept(visitor);
+        break;
+      case Opcode::cos:
+        CosExpr(r.a).accept(visitor);
+        break;
+      case Opcode::checkpoint:
+        CheckpointExpr(r.a).accept(visitor);
+        break;
+      case Opcode::add:
+        AddExpr(r.a, r.b).accept(visitor);
+        break;
+      case Opcode::sub:
+        SubExpr(r.a, r.b).accept(visitor);
+        break;
+      case Opcode::mul:
+        MulExpr(r.a, r.b).accept(visitor);
+        break;
+      case Opcode::output:
+        OutputExpr(r.a, r.b).accept(visitor);
+        break;
+    }
+  }
+
+private:
+  std::shared_ptr<const FileMapping> m_mapping;
+
+  FileHeader m_header{};
+
+  const FileRecord* m_records{ nullptr };
+
+  const char* m_strings{ nullptr };
+};
+
+/* Checks every record, so that visiting the module never reads outside of the mapping. Operands have to refer to
+ * earlier expressions, like they do in modules that are built by the module builder, and the indices of inputs,
+ * parameters and outputs have to be within the counts of the header, which the exporters size their arrays with.
+ * */
+void
+validate(const FileHeader& header, const FileRecord* records, const size_t size)
+{
+  const auto recordsSize = static_cast<size_t>(header.numExprs) * sizeof(FileRecord);
+
+  if ((sizeof(FileHeader) + recordsSize + header.stringsSize) != size) {
+    throw Exception("module file has the wrong size");
+  }
+
+  for (uint32_t i = 0; i < header.numExprs; i++) {
+    const auto& r = records[i];
+    bool valid = true;
+    switch (static_cast<Opcode>(r.opcode)) {
+      case Opcode::input:
+        valid = (r.a < header.numInputs) && (r.b <= header.stringsSize) && (r.c <= (header.stringsSize - r.b));
+        break;
+      case Opcode::param:
+        valid = (r.a < header.numParameters) && (r.b <= header.stringsSize) && (r.c <= (header.stringsSize - r.b));
+        break;
+      case Opcode::constant:
+        break;
+      case Opcode::negate:
+      case Opcode::rcp:
+      case Opcode::sqrt:
+      case Opcode::exp:
+      case Opcode::relu:
+      case Opcode::sigmoid:
+      case Opcode::heaviside:
+      case Opcode::sin:
+      case Opcode::cos:
+      case Opcode::checkpoint:
+        valid = r.a < i;
+        break;
+      case Opcode::add:
+      case Opcode::sub:
+      case Opcode::mul:
+        valid = (r.a < i) && (r.b < i);
+        break;
+      case Opcode::output:
+        valid = (r.a < header.numOutputs) && (r.b < i);
+        break;
+      default:
+        valid = false;
+        break;
+    }
+    if (!valid) {
+      throw Exception("module file has an invalid expression at index " + std::to_string(i));
+    }
+  }
+}
+
+} // namespace
+
+void
+saveModule(const Module& module, const std::filesystem::path& path)
+{
+  RecordWriter writer;
+  module.visit(writer);
+
+  FileHeader header{};
+  memcpy(header.magic, fileMagic, sizeof(fileMagic));
+  header.version = fileVersion;
+  header.byteOrder = fileByteOrder;
+  header.numParameters = module.numParameters();
+  header.numInputs = module.numInputs();
+  header.numOutputs = module.numOutputs();
+  header.numExprs = static_cast<uint32_t>(writer.records().size());
+  header.stringsSize = static_cast<uint32_t>(writer.strings().size());
+
+  std::ofstream file(path, std::ios::binary);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(writer.records().data()),
+             static_cast<std::streamsize>(writer.records().size() * sizeof(FileRecord)));
+  file.write(writer.strings().data(), static_cast<std::streamsize>(writer.strings().size()));
+  file.close();
+
+  if (!file) {
+    throw Exception("failed to write module file \"" + path.string() + "\"");
+  }
+}
+
+auto
+loadModule(const std::filesystem::path& path) -> std::unique_ptr<Module>
+{
+  auto mapping = std::make_shared<const FileMapping>(path);
+  const auto size = mapping->size();
+
+  FileHeader header{};
+  memcpy(&header, mapping->bytes(), sizeof(header));
+
+  if (memcmp(header.magic, fileMagic, sizeof(fileMagic)) != 0) {
+    throw Exception("\"" + path.string() + "\" is not a module file");
+  }
+
+  if (header.byteOrder != fileByteOrder) {
+    throw Exception("module file \"" + path.string() + "\" was written with a different byte order");
+  }
+
+  if (header.version != fileVersion) {
+    throw Exception("module file \"" + path.string() + "\" has unsupported version " + std::to_string(header.version));
+  }
+
+  validate(header, reinterpret_cast<const FileRecord*>(mapping->bytes() + sizeof(FileHeader)), size);
+
+  return std::make_unique<MappedModule>(std::move(mapping));
+}
+
+} // namespace axon
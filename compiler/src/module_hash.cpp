@@ -0,0 +1,125 @@
+#include <axon/module.hpp>
+
+#include <axon/expr.hpp>
+#include <axon/expr_visitor.hpp>
+
+#include <string.h>
+
+namespace axon {
+
+namespace {
+
+/* Computes a 64-bit FNV-1a hash over the kind and operands of every expression in a module.
+ * */
+class ModuleHasher final : public ExprVisitor
+{
+public:
+  [[nodiscard]] auto hash() const -> uint64_t { return m_hash; }
+
+  void visit(const InputExpr& e) override
+  {
+    add(1);
+    add(e.index());
+  }
+
+  void visit(const ParamExpr& e) override
+  {
+    add(2);
+    add(e.index());
+    const auto name = e.name();
+    add(static_cast<uint32_t>(name.size()));
+    addBytes(name.data(), name.size());
+  }
+
+  void visit(const ConstExpr& e) override
+  {
+    const auto value = e.value();
+    uint32_t bits{};
+    memcpy(&bits, &value, sizeof(bits));
+    add(3);
+    add(bits);
+  }
+
+  void visit(const NegateExpr& e) override { addUnary(4, e); }
+
+  void visit(const RcpExpr& e) override { addUnary(5, e); }
+
+  void visit(const SqrtExpr& e) override { addUnary(6, e); }
+
+  void visit(const ExpExpr& e) override { addUnary(7, e); }
+
+  void visit(const ReLUExpr& e) override { addUnary(8, e); }
+
+  void visit(const SigmoidExpr& e) override { addUnary(9, e); }
+
+  void visit(const HeavisideExpr& e) override { addUnary(10, e); }
+
+  void visit(const SinExpr& e) override { addUnary(11, e); }
+
+  void visit(const CosExpr& e) override { addUnary(12, e); }
+
+  void visit(const CheckpointExpr& e) override { addUnary(17, e); }
+
+  void visit(const AddExpr& e) override { addBinary(13, e); }
+
+  void visit(const SubExpr& e) override { addBinary(14, e); }
+
+  void visit(const MulExpr& e) override { addBinary(15, e); }
+
+  void visit(const OutputExpr& e) override
+  {
+    add(16);
+    add(e.outputIndex());
+    add(e.valueIndex());
+  }
+
+  void add(const uint32_t value)
+  {
+    uint8_t bytes[4];
+    for (int i = 0; i < 4; i++) {
+      bytes[i] = static_cast<uint8_t>((value >> (i * 8)) & 0xffU);
+    }
+    addBytes(bytes, sizeof(bytes));
+  }
+
+protected:
+  void addUnary(const uint32_t kind, const UnaryExpr& e)
+  {
+    add(kind);
+    add(e.operand());
+  }
+
+  void addBinary(const uint32_t kind, const BinaryExpr& e)
+  {
+    add(kind);
+    add(e.left());
+    add(e.right());
+  }
+
+  void addBytes(const void* data, const size_t size)
+  {
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++) {
+      m_hash ^= bytes[i];
+      m_hash *= 0x100000001b3ULL;
+    }
+  }
+
+private:
+  uint64_t m_hash{ 0xcbf29ce484222325ULL };
+};
+
+} // namespace
+
+auto
+hashModule(const Module& module) -> uint64_t
+{
+  ModuleHasher hasher;
+  hasher.add(module.numParameters());
+  hasher.add(module.numInputs());
+  hasher.add(module.numOutputs());
+  module.visit(hasher);
+  return hasher.hash();
+}
+
+} // namespace axon
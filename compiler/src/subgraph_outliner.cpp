@@ -0,0 +1,452 @@
+#include "subgraph_outliner.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+namespace axon {
+
+namespace {
+
+/* Returns a statement without its stores, which is how the statements that only read the arguments are repeated. */
+[[nodiscard]] auto
+withoutStores(CStatement s) -> CStatement
+{
+  s.stores.clear();
+  return s;
+}
+
+} // namespace
+
+SubgraphOutliner::SubgraphOutliner(const std::vector<Statement>& statements,
+                                   const std::string& name,
+                                   const std::vector<std::string>& params)
+  : m_statements(statements)
+  , m_name(name)
+  , m_params(params)
+  , m_positions(statements.size(), SIZE_MAX)
+{
+  for (const auto& param : params) {
+    if (param.find('*') != std::string::npos) {
+      m_pointers.emplace(argumentName(param));
+    }
+  }
+
+  for (size_t i = 0; i < statements.size(); i++) {
+    for (const auto value : statements[i].values) {
+      m_definitions.emplace(value, i);
+    }
+    if (!isLeaf(i)) {
+      m_positions[i] = m_sequence.size();
+      m_sequence.emplace_back(i);
+    }
+  }
+
+  for (size_t p = 0; p < m_sequence.size(); p++) {
+    for (const auto op : statements[m_sequence[p]].operands) {
+      m_lastUse[op] = p;
+    }
+  }
+}
+
+auto
+SubgraphOutliner::outline() -> std::vector<Statement>
+{
+  const auto m = m_sequence.size();
+
+  // Statements with the same shape get the same id. Statements that are already outlined get ids of their own.
+  std::vector<size_t> ids(m);
+  std::map<std::string, size_t> shapes;
+  for (size_t p = 0; p < m; p++) {
+    ids[p] = shapes.emplace(anonymousShape(p), shapes.size()).first->second;
+  }
+
+  // The number of lines up to each statement, which is how the size of the code is measured.
+  std::vector<int64_t> lines(m + 1, 0);
+  for (size_t p = 0; p < m; p++) {
+    lines[p + 1] = lines[p] + numLines(m_statements[m_sequence[p]]);
+  }
+
+  // The number of values that are live across the point before each statement, which is what an occurrence that
+  // starts or ends there has to pass to or from its block.
+  std::vector<int64_t> live(m + 1, 0);
+  for (const auto& [value, last] : m_lastUse) {
+    const auto def = m_definitions.at(value);
+    if (!isLeaf(def)) {
+      live[m_positions[def] + 1]++;
+      live[last + 1]--;
+    }
+  }
+  for (size_t p = 1; p <= m; p++) {
+    live[p] += live[p - 1];
+  }
+
+  std::vector<std::vector<Instance>> groups;
+
+  while (true) {
+    std::vector<Candidate> candidates;
+
+    const auto matches = [&ids](const size_t p, const size_t length) { return ids[p] == ids[p + length]; };
+
+    for (size_t length = minStatements; (2 * length) <= m; length++) {
+      // A run of at least length matches contains a position that is one less than a multiple of the length, so
+      // only those positions are checked before the run is extended.
+      auto p = length - 1;
+      while ((p + length) < m) {
+        if (!matches(p, length)) {
+          p += length;
+          continue;
+        }
+        auto first = p;
+        while ((first > 0) && matches(first - 1, length)) {
+          first--;
+        }
+        auto last = p;
+        while (((last + 1 + length) < m) && matches(last + 1, length)) {
+          last++;
+        }
+        p = last + length - ((last + 1) % length);
+
+        const auto run = last + 1 - first;
+        if (run < length) {
+          continue;
+        }
+
+        // The statements from first to last + length repeat with this period, so an occurrence can start anywhere
+        // that leaves room for the same number of them.
+        const auto count = (run / length) + 1;
+        auto start = first;
+        for (auto s = first; s <= (first + run - (count - 1) * length); s++) {
+          if ((live[s] + live[s + length]) < (live[start] + live[start + length])) {
+            start = s;
+          }
+        }
+        const auto size = lines[start + length] - lines[start];
+        const auto estimate =
+          static_cast<int64_t>(count - 1) * size - static_cast<int64_t>(count) * (live[start] + live[start + length]);
+        if (estimate > 0) {
+          candidates.push_back({ start, length, count, estimate });
+        }
+      }
+    }
+
+    std::stable_sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+      return a.estimate > b.estimate;
+    });
+
+    std::vector<Instance> group;
+    for (const auto& candidate : candidates) {
+      group = verify(candidate);
+      if (!group.empty()) {
+        break;
+      }
+    }
+
+    if (group.empty()) {
+      break;
+    }
+
+    for (const auto& instance : group) {
+      for (auto p = instance.start; p < (instance.start + instance.shape.size()); p++) {
+        ids[p] = m + p;
+      }
+    }
+    groups.emplace_back(std::move(group));
+  }
+
+  if (groups.empty()) {
+    return m_statements;
+  }
+
+  std::sort(groups.begin(), groups.end(), [](const std::vector<Instance>& a, const std::vector<Instance>& b) {
+    return a[0].start < b[0].start;
+  });
+
+  std::set<size_t> removed;
+  std::map<size_t, Statement> calls;
+  for (const auto& group : groups) {
+    const auto& block = addBlock(group[0]);
+    for (const auto& instance : group) {
+      const auto length = instance.shape.size();
+      for (auto p = instance.start; p < (instance.start + length); p++) {
+        removed.emplace(m_sequence[p]);
+      }
+      calls.emplace(m_sequence[instance.start + length - 1], call(block, instance));
+    }
+  }
+
+  std::vector<Statement> result;
+  for (size_t i = 0; i < m_statements.size(); i++) {
+    if (const auto c = calls.find(i); c != calls.end()) {
+      result.emplace_back(c->second);
+    } else if (removed.count(i) == 0) {
+      result.emplace_back(m_statements[i]);
+    }
+  }
+
+  // The blocks repeat the statements that only read the arguments, so some of them may no longer be needed here.
+  std::set<uint32_t> used;
+  for (const auto& statement : result) {
+    used.insert(statement.operands.begin(), statement.operands.end());
+  }
+  result.erase(std::remove_if(result.begin(),
+                              result.end(),
+                              [&](const Statement& s) {
+                                return s.leaf() && s.stores.empty() && (used.count(s.values[0]) == 0) &&
+                                       (m_lastUse.count(s.values[0]) != 0);
+                              }),
+               result.end());
+
+  return result;
+}
+
+
+auto
+SubgraphOutliner::accesses(const Statement& s, std::vector<const Statement::Access*>* result) -> bool
+{
+  switch (s.op) {
+    case Statement::Op::call:
+      return false;
+    case Statement::Op::param:
+    case Statement::Op::load:
+    case Statement::Op::output:
+    case Statement::Op::accumulate:
+    case Statement::Op::loop:
+      result->emplace_back(&s.access);
+      break;
+    default:
+      break;
+  }
+  for (const auto& store : s.stores) {
+    result->emplace_back(&store.second);
+  }
+  return true;
+}
+
+auto
+SubgraphOutliner::statementShape(const Statement& s, const std::map<std::string, uint32_t>* bases) const
+  -> std::string
+{
+  std::vector<const Statement::Access*> elements;
+  if (!accesses(s, &elements)) {
+    return {};
+  }
+
+  std::ostringstream shape;
+  shape << static_cast<int>(s.op) << ' ' << s.values.size() << ' ' << s.operands.size();
+  if (!s.constant.empty()) {
+    shape << " =" << s.constant;
+  }
+  if (s.op == Statement::Op::loop) {
+    shape << ' ' << s.loop.rows << ' ' << s.loop.rowStride << ' ' << s.loop.stride;
+  }
+  for (const auto* element : elements) {
+    shape << ' ' << element->array << '[';
+    if (m_pointers.count(element->array) == 0) {
+      shape << element->index;
+    } else if (bases != nullptr) {
+      shape << (element->index - bases->at(element->array));
+    } else {
+      shape << '#';
+    }
+    shape << ']';
+  }
+  for (const auto& store : s.stores) {
+    shape << " >" << (std::find(s.values.begin(), s.values.end(), store.first) - s.values.begin());
+  }
+  return shape.str();
+}
+
+auto
+SubgraphOutliner::anonymousShape(const size_t p) const -> std::string
+{
+  const auto& s = m_statements[m_sequence[p]];
+  auto shape = statementShape(s, nullptr);
+  if (shape.empty()) {
+    return "!" + std::to_string(p);
+  }
+  for (const auto op : s.operands) {
+    const auto def = m_definitions.at(op);
+    if (isLeaf(def)) {
+      shape += " L" + statementShape(withoutStores(m_statements[def]), nullptr);
+    } else {
+      shape += " V";
+    }
+  }
+  return shape;
+}
+
+auto
+SubgraphOutliner::numLines(const Statement& s) -> int64_t
+{
+  const auto code = formatStatement(s);
+  return static_cast<int64_t>(std::count(code.begin(), code.end(), '\n')) + 1;
+}
+
+auto
+SubgraphOutliner::valueIndex(const size_t def, const uint32_t value) const -> size_t
+{
+  const auto& values = m_statements[def].values;
+  return static_cast<size_t>(std::find(values.begin(), values.end(), value) - values.begin());
+}
+
+auto
+SubgraphOutliner::describe(const size_t start, const size_t length, Instance* instance) const -> bool
+{
+  instance->start = start;
+
+  const auto lowest = [this, instance](const Statement& s) {
+    std::vector<const Statement::Access*> elements;
+    if (!accesses(s, &elements)) {
+      return false;
+    }
+    for (const auto* element : elements) {
+      if (m_pointers.count(element->array) == 0) {
+        continue;
+      }
+      const auto it = instance->bases.find(element->array);
+      if ((it == instance->bases.end()) || (element->index < it->second)) {
+        instance->bases[element->array] = element->index;
+      }
+    }
+    return true;
+  };
+
+  for (auto p = start; p < (start + length); p++) {
+    const auto& s = m_statements[m_sequence[p]];
+    if (!lowest(s)) {
+      return false;
+    }
+    for (const auto op : s.operands) {
+      const auto def = m_definitions.at(op);
+      if (isLeaf(def) && instance->leaves.emplace(def).second && !lowest(withoutStores(m_statements[def]))) {
+        return false;
+      }
+    }
+  }
+
+  std::map<uint32_t, size_t> slots;
+  for (auto p = start; p < (start + length); p++) {
+    const auto& s = m_statements[m_sequence[p]];
+    auto shape = statementShape(s, &instance->bases);
+    for (const auto op : s.operands) {
+      const auto def = m_definitions.at(op);
+      if (isLeaf(def)) {
+        shape += " L" + statementShape(withoutStores(m_statements[def]), &instance->bases);
+      } else if (m_positions[def] >= start) {
+        shape += " I" + std::to_string(m_positions[def] - start) + '.' + std::to_string(valueIndex(def, op));
+      } else {
+        const auto slot = slots.emplace(op, slots.size());
+        if (slot.second) {
+          instance->externals.emplace_back(op);
+        }
+        shape += " E" + std::to_string(slot.first->second);
+      }
+    }
+    for (const auto value : s.values) {
+      const auto last = m_lastUse.find(value);
+      const auto isOutput = (last != m_lastUse.end()) && (last->second >= (start + length));
+      if (isOutput) {
+        instance->outputs.emplace_back(value);
+      }
+      shape += isOutput ? " O" : " -";
+    }
+    instance->shape.emplace_back(std::move(shape));
+  }
+
+  return true;
+}
+
+auto
+SubgraphOutliner::verify(const Candidate& candidate) const -> std::vector<Instance>
+{
+  std::vector<Instance> group;
+  for (size_t k = 0; k < candidate.count; k++) {
+    Instance instance;
+    if (!describe(candidate.start + k * candidate.length, candidate.length, &instance)) {
+      continue;
+    }
+    if (group.empty() || (instance.shape == group[0].shape)) {
+      group.emplace_back(std::move(instance));
+    }
+  }
+
+  if (group.size() < 2) {
+    return {};
+  }
+
+  // The lines of the occurrences that are removed, minus the lines of the block and of the calls.
+  const auto& first = group[0];
+  int64_t size{};
+  for (size_t k = 0; k < first.shape.size(); k++) {
+    size += numLines(m_statements[m_sequence[first.start + k]]);
+  }
+  const auto numExternals = static_cast<int64_t>(first.externals.size());
+  const auto numOutputs = static_cast<int64_t>(first.outputs.size());
+  const auto numCalls = static_cast<int64_t>(group.size());
+  const auto block = numExternals + static_cast<int64_t>(first.leaves.size()) + size + numOutputs;
+  const auto call = ((numExternals + 7) / 8) + 2 + numOutputs;
+  const auto saved = numCalls * size - block - numCalls * call;
+  if (first.externals.empty() || first.outputs.empty() || (saved <= 0)) {
+    return {};
+  }
+
+  return group;
+}
+
+auto
+SubgraphOutliner::addBlock(const Instance& instance) -> const Block&
+{
+  std::set<std::string> arguments;
+
+  std::ostringstream body;
+  for (size_t k = 0; k < instance.externals.size(); k++) {
+    body << "  const float v" << instance.externals[k] << " = in[" << k << "];\n";
+  }
+  for (const auto leaf : instance.leaves) {
+    const auto s = withoutStores(m_statements[leaf]);
+    body << "  " << formatStatement(s, instance.bases) << '\n';
+    arguments.merge(statementArguments(s));
+  }
+  for (size_t k = 0; k < instance.shape.size(); k++) {
+    const auto& s = m_statements[m_sequence[instance.start + k]];
+    body << "  " << formatStatement(s, instance.bases) << '\n';
+    arguments.merge(statementArguments(s));
+  }
+  for (size_t k = 0; k < instance.outputs.size(); k++) {
+    body << "  out[" << k << "] = v" << instance.outputs[k] << ";\n";
+  }
+
+  Block block;
+  block.name = m_name + "_block" + std::to_string(m_blocks.size());
+  block.body = body.str();
+
+  // Only the arguments that the block uses are passed to it.
+  for (const auto& param : m_params) {
+    if (arguments.count(argumentName(param)) != 0) {
+      block.params.emplace_back(param);
+    }
+  }
+  block.params.emplace_back("const float* AXON_RESTRICT in");
+  block.params.emplace_back("float* AXON_RESTRICT out");
+
+  m_blocks.emplace_back(std::move(block));
+  return m_blocks.back();
+}
+
+auto
+SubgraphOutliner::call(const Block& block, const Instance& instance) const -> Statement
+{
+  Statement statement;
+  statement.op = Statement::Op::call;
+  statement.values = instance.outputs;
+  statement.operands = instance.externals;
+  statement.callee = block.name;
+  for (auto k = 0U; (k + 2) < block.params.size(); k++) {
+    const auto arg = argumentName(block.params[k]);
+    const auto base = instance.bases.find(arg);
+    statement.arguments.push_back({ arg, (base != instance.bases.end()) ? base->second : 0 });
+  }
+  return statement;
+}
+
+} // namespace axon
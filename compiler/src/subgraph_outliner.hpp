@@ -0,0 +1,166 @@
+#pragma once
+
+#include "c_statement.hpp"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace axon {
+
+/**
+ * @brief Moves repeated subgraphs of a function body, such as the layers of a network that only differ by their
+ *        parameters, to functions that are defined once and called for each occurrence.
+ *
+ * @details Each statement that computes something gets an id from its shape, which is what it computes and which
+ *          arrays it accesses, but not the names of its values or the indices of the elements in pointer arguments
+ *          (such as parameters[672]). The shapes of the operands that only read the arguments are part of it. Runs
+ *          of statements whose ids repeat with some period are the candidates. A candidate is only outlined if its
+ *          occurrences are really the same code: with the indices taken relative to the lowest index that each
+ *          occurrence uses with the same argument, the statements have to match one by one, each operand has to come
+ *          from the same place, and the same values have to be used after each occurrence.
+ *
+ *          The function for a shape takes the pointer arguments offset by those lowest indices, the values from before
+ *          the occurrence, and a buffer for the values that are used after it. Statements that only read the
+ *          arguments, such as parameters and constants, are repeated in the function instead of passed to it. The
+ *          statements and the order of the operations stay the same, so the results do not change.
+ * */
+class SubgraphOutliner final
+{
+public:
+  using Statement = CStatement;
+
+  /**
+   * @brief The fewest statements that an occurrence is searched for with, which keeps the search short.
+   * */
+  static constexpr size_t minStatements = 16;
+
+  /**
+   * @brief A function that the occurrences of a shape are replaced with calls to.
+   * */
+  struct Block final
+  {
+    std::string name;
+
+    std::vector<std::string> params;
+
+    /**
+     * @brief The statements of the function body, already indented.
+     * */
+    std::string body;
+  };
+
+  /**
+   * @param name The name of the function that the statements belong to, which the blocks are named after.
+   *
+   * @param params The declarations of the parameters of the function.
+   * */
+  SubgraphOutliner(const std::vector<Statement>& statements,
+                   const std::string& name,
+                   const std::vector<std::string>& params);
+
+  /**
+   * @brief Returns the statements with the occurrences of repeated shapes replaced by calls to the blocks.
+   * */
+  [[nodiscard]] auto outline() -> std::vector<Statement>;
+
+  [[nodiscard]] auto blocks() const -> const std::vector<Block>& { return m_blocks; }
+
+protected:
+  /* A run of statements that may be repeated. */
+  struct Candidate final
+  {
+    /* The position of the first occurrence, among the statements that are not leaves. */
+    size_t start{};
+
+    size_t length{};
+
+    size_t count{};
+
+    /* The number of lines that outlining may save, minus the number of values passed to and from the block. */
+    int64_t estimate{};
+  };
+
+  /* An occurrence of a shape. */
+  struct Instance final
+  {
+    size_t start{};
+
+    /* The lowest index that the occurrence uses with each pointer argument. */
+    std::map<std::string, uint32_t> bases;
+
+    /* The shape of each statement with the indices made relative to the bases, followed by where each operand comes
+     * from and which values are used after the occurrence. Two occurrences of the same shape have the same shapes. */
+    std::vector<std::string> shape;
+
+    /* The values that are defined before the occurrence, in the order of their first use. */
+    std::vector<uint32_t> externals;
+
+    /* The statements that only read the arguments, which the block repeats. */
+    std::set<size_t> leaves;
+
+    /* The values that are used after the occurrence. */
+    std::vector<uint32_t> outputs;
+  };
+
+  [[nodiscard]] auto isLeaf(const size_t i) const -> bool { return m_statements[i].leaf(); }
+
+  /* Returns the array elements that a statement accesses, or false if it can not be moved to a block. */
+  [[nodiscard]] static auto accesses(const Statement& s, std::vector<const Statement::Access*>* result) -> bool;
+
+  /* Returns what a statement computes and which elements it accesses. The indices of the pointer arguments are left
+   * out if there are no bases, and are relative to the bases otherwise. Returns an empty string if the statement can
+   * not be moved to a block. */
+  [[nodiscard]] auto statementShape(const Statement& s, const std::map<std::string, uint32_t>* bases) const
+    -> std::string;
+
+  /* Returns the shape of a statement without its indices, followed by the shapes of the operands that only read the
+   * arguments. The position is among the statements that are not leaves. */
+  [[nodiscard]] auto anonymousShape(size_t p) const -> std::string;
+
+  [[nodiscard]] static auto numLines(const Statement& s) -> int64_t;
+
+  [[nodiscard]] auto valueIndex(size_t def, uint32_t value) const -> size_t;
+
+  /* Describes the occurrence of the given length that starts at the given position. Returns false if it can not be
+   * moved to a block. */
+  [[nodiscard]] auto describe(size_t start, size_t length, Instance* instance) const -> bool;
+
+  /* Returns the occurrences of a candidate that have the same shape as the first one, or nothing if outlining them
+   * would not make the function shorter. */
+  [[nodiscard]] auto verify(const Candidate& candidate) const -> std::vector<Instance>;
+
+  /* Defines the block for the shape of an occurrence, using its names. */
+  [[nodiscard]] auto addBlock(const Instance& instance) -> const Block&;
+
+  /* Returns the statement that calls a block for an occurrence of its shape. */
+  [[nodiscard]] auto call(const Block& block, const Instance& instance) const -> Statement;
+
+private:
+  const std::vector<Statement>& m_statements;
+
+  std::string m_name;
+
+  std::vector<std::string> m_params;
+
+  /* The names of the arguments that are pointers. */
+  std::set<std::string> m_pointers;
+
+  std::map<uint32_t, size_t> m_definitions;
+
+  /* The statements that are not leaves, and the position of each statement among them. */
+  std::vector<size_t> m_sequence;
+
+  std::vector<size_t> m_positions;
+
+  /* The position of the last statement that uses each value. */
+  std::map<uint32_t, size_t> m_lastUse;
+
+  std::vector<Block> m_blocks;
+};
+
+} // namespace axon
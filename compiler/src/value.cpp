@@ -14,25 +14,27 @@ Value::constant(const float value) -> Value
 }
 
 auto
-Value::input() -> Value
+Value::input(const std::string_view& group) -> Value
 {
-  return ModuleBuilder::current()->input();
+  return ModuleBuilder::current()->input(group);
 }
 
 auto
-Value::param(const std::string_view& name) -> Value
+Value::param(const std::string_view& name, const bool frozen) -> Value
 {
-  return ModuleBuilder::current()->param(name);
+  return ModuleBuilder::current()->param(name, 1, frozen);
 }
 
 auto
-Value::param(const std::string_view& name, const size_t index) -> Value
+Value::param(const std::string_view& name, const size_t index, const size_t size, const bool frozen) -> Value
 {
   // for arrays, we don't want to emit a name for each element
 
-  const auto filteredName = (index == 0) ? name : std::string_view();
+  if (index > 0) {
+    return ModuleBuilder::current()->param(std::string_view(), 1, frozen);
+  }
 
-  return ModuleBuilder::current()->param(filteredName);
+  return ModuleBuilder::current()->param(name, static_cast<uint32_t>(size), frozen);
 }
 
 Value::Value()
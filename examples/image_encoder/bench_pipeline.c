@@ -0,0 +1,172 @@
+/* This program measures how much of the sample preparation can be hidden behind gradient computation by the
+ * prefetching input pipeline. Samples are prepared the way the image encoder used to do it, by picking random pixels
+ * of the decoded image and converting them to training records.
+ *
+ * Usage: axon_bench_image_encoder_pipeline [image]
+ * */
+
+#define AXON_THREADS
+
+#include "image_encoder.h"
+
+#include "deps/stb_image.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BATCH_SIZE 64
+#define BATCHES 4096
+
+struct image
+{
+  stbi_uc* pixels;
+
+  int w;
+
+  int h;
+
+  axon_crng_z rng;
+
+  size_t batches;
+};
+
+static double
+now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((double)t.tv_sec) + ((double)t.tv_nsec) * 1.0e-9;
+}
+
+static size_t
+fill(void* user, float* batch, const size_t capacity)
+{
+  struct image* img = (struct image*)user;
+  if (img->batches == 0) {
+    return 0;
+  }
+  img->batches--;
+
+  for (size_t i = 0; i < capacity; i++) {
+    const uint32_t x = axon_crng_range(&img->rng, 0, (uint32_t)img->w - 1);
+    const uint32_t y = axon_crng_range(&img->rng, 0, (uint32_t)img->h - 1);
+    const stbi_uc* rgb = img->pixels + (y * ((uint32_t)img->w) + x) * 3;
+    float* record = batch + i * AXON_GRAD_INPUTS;
+    record[0] = ((float)x) / ((float)img->w);
+    record[1] = ((float)y) / ((float)img->h);
+    record[2] = ((float)rgb[0]) / 255.0F;
+    record[3] = ((float)rgb[1]) / 255.0F;
+    record[4] = ((float)rgb[2]) / 255.0F;
+  }
+
+  return capacity;
+}
+
+struct trainer
+{
+  float parameters[AXON_PARAMETERS];
+
+  axon_opt_z opt;
+
+  float* scratch;
+};
+
+static void
+trainer_init(struct trainer* t)
+{
+  axon_rng_z rng;
+  axon_rng_init(&rng, 0);
+  axon_rng_float_array(&rng, t->parameters, AXON_PARAMETERS, 0.2F, -0.1F);
+  axon_opt_init(&t->opt, 0);
+}
+
+static void
+trainer_step(struct trainer* t, const float* batch, const size_t count)
+{
+  axon_grad_sharded(t->parameters, batch, count, 1, t->scratch, t->opt.gradient);
+  axon_opt_step(&t->opt, 0.01F, 0.9F, t->parameters);
+}
+
+int
+main(int argc, char** argv)
+{
+  struct image img;
+  img.pixels = stbi_load((argc > 1) ? argv[1] : "sample.png", &img.w, &img.h, NULL, 3);
+  if (!img.pixels) {
+    fprintf(stderr, "failed to load image\n");
+    return EXIT_FAILURE;
+  }
+
+  struct trainer* t = malloc(sizeof(struct trainer));
+  float* batch = malloc(BATCH_SIZE * AXON_GRAD_INPUTS * sizeof(float));
+  if (!t || !batch || (posix_memalign((void**)&t->scratch, AXON_BUFFER_ALIGN, AXON_BUFFER_SIZE) != 0)) {
+    return EXIT_FAILURE;
+  }
+
+  /* preparation only */
+  axon_crng_init(&img.rng, 1);
+  img.batches = BATCHES;
+  double t0 = now();
+  while (fill(&img, batch, BATCH_SIZE) != 0) {
+  }
+  const double prepare_time = now() - t0;
+
+  /* gradients only, on the same batch */
+  trainer_init(t);
+  t0 = now();
+  for (int i = 0; i < BATCHES; i++) {
+    trainer_step(t, batch, BATCH_SIZE);
+  }
+  const double grad_time = now() - t0;
+
+  /* serial */
+  trainer_init(t);
+  axon_crng_init(&img.rng, 1);
+  img.batches = BATCHES;
+  t0 = now();
+  for (;;) {
+    const size_t count = fill(&img, batch, BATCH_SIZE);
+    if (count == 0) {
+      break;
+    }
+    trainer_step(t, batch, count);
+  }
+  const double serial_time = now() - t0;
+
+  /* pipelined */
+  trainer_init(t);
+  axon_crng_init(&img.rng, 1);
+  img.batches = BATCHES;
+  t0 = now();
+  axon_pipeline_z pipeline;
+  if (axon_pipeline_init(&pipeline, BATCH_SIZE, fill, &img) != 0) {
+    fprintf(stderr, "failed to start pipeline\n");
+    return EXIT_FAILURE;
+  }
+  for (;;) {
+    const float* next = NULL;
+    const size_t count = axon_pipeline_acquire(&pipeline, &next);
+    if (count == 0) {
+      break;
+    }
+    trainer_step(t, next, count);
+    axon_pipeline_release(&pipeline);
+  }
+  axon_pipeline_destroy(&pipeline);
+  const double pipelined_time = now() - t0;
+
+  printf("prepare only:  %8.3f s\n", prepare_time);
+  printf("grad only:     %8.3f s\n", grad_time);
+  printf("serial:        %8.3f s\n", serial_time);
+  printf("pipelined:     %8.3f s\n", pipelined_time);
+  printf("hidden:        %7.1f %% of the preparation time\n",
+         100.0 * (serial_time - pipelined_time) / prepare_time);
+
+  free(t->scratch);
+  free(t);
+  free(batch);
+  stbi_image_free(img.pixels);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,102 @@
+/* This program measures how the synchronous, data-parallel training step scales with the number of threads.
+ * For each thread count, the network is trained twice from the same initial parameters on the same data, in order
+ * to check that the results are deterministic.
+ *
+ * Usage: axon_bench_image_encoder_threads [max_threads]
+ * */
+
+#define AXON_THREADS
+
+#include "image_encoder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static double
+now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((double)t.tv_sec) + ((double)t.tv_nsec) * 1.0e-9;
+}
+
+static double
+train(const size_t num_threads, const float* inputs, const size_t batches, const size_t batch_size, float* parameters)
+{
+  axon_rng_z rng;
+  axon_rng_init(&rng, 0);
+  axon_rng_float_array(&rng, parameters, AXON_PARAMETERS, 0.2F, -0.1F);
+
+  axon_opt_z opt;
+  axon_opt_init(&opt, 0);
+
+  axon_pool_z pool;
+  if (axon_pool_init(&pool, num_threads) != 0) {
+    fprintf(stderr, "failed to create thread pool\n");
+    exit(EXIT_FAILURE);
+  }
+
+  const double t0 = now();
+
+  for (size_t i = 0; i < batches; i++) {
+    axon_pool_grad(&pool, parameters, inputs + i * batch_size * AXON_GRAD_INPUTS, batch_size, opt.gradient);
+    axon_opt_step(&opt, 0.01F, 0.9F, parameters);
+  }
+
+  const double t1 = now();
+
+  axon_pool_destroy(&pool);
+
+  return t1 - t0;
+}
+
+int
+main(int argc, char** argv)
+{
+  long max_threads = (argc > 1) ? atol(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+  max_threads = (max_threads < 1) ? 1 : max_threads;
+  max_threads = (max_threads > AXON_MAX_THREADS) ? AXON_MAX_THREADS : max_threads;
+
+  const size_t batch_size = 256;
+  const size_t batches = 256;
+
+  float* inputs = malloc(batches * batch_size * AXON_GRAD_INPUTS * sizeof(float));
+  if (!inputs) {
+    return EXIT_FAILURE;
+  }
+
+  axon_rng_z rng;
+  axon_rng_init(&rng, 1);
+  axon_rng_float_array(&rng, inputs, batches * batch_size * AXON_GRAD_INPUTS, 1.0F, 0.0F);
+
+  float p0[AXON_PARAMETERS];
+  float p1[AXON_PARAMETERS];
+
+  double baseline = 0.0;
+
+  printf("threads  samples/s  speedup  deterministic\n");
+
+  for (long n = 1; n <= max_threads; n++) {
+
+    const double dt = train((size_t)n, inputs, batches, batch_size, p0);
+
+    (void)train((size_t)n, inputs, batches, batch_size, p1);
+
+    const int deterministic = memcmp(p0, p1, sizeof(p0)) == 0;
+
+    if (n == 1) {
+      baseline = dt;
+    }
+
+    const double rate = ((double)(batches * batch_size)) / dt;
+
+    printf("%7ld  %9.0f  %7.2f  %s\n", n, rate, baseline / dt, deterministic ? "yes" : "no");
+  }
+
+  free(inputs);
+
+  return EXIT_SUCCESS;
+}
@@ -19,9 +19,20 @@ compile(axon::Compiler& compiler)
 
   compiler.buildEvalModule({ rgb[0], rgb[1], rgb[2] });
 
+  // The preview image is rendered row by row, so everything that only depends on v is computed once per row.
+  compiler.addEvalStage("v", { v });
+  compiler.addEvalStage("u", { u });
+
+  compiler.buildBackwardModule();
+
+  // The sensitivity of the color to the texture coordinates.
+  compiler.buildJvpModule({ rgb[0], rgb[1], rgb[2] }, { u, v });
+
   const auto target = axon::input<3, 1>();
 
   const auto loss = axon::mse(target, rgb);
 
   compiler.buildGradModule(loss);
+
+  compiler.buildHvpModule(loss);
 }
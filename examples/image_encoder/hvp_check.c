@@ -0,0 +1,145 @@
+/* This program checks axon_hvp against a central finite difference of axon_grad, for random parameters, samples and
+ * vectors:
+ *
+ *   H v ~= (grad(p + e v) - grad(p - e v)) / (2 e)
+ *
+ * The network uses ReLU activations, so the step has to stay small enough that it rarely moves a pre-activation across
+ * zero. A step that crosses a kink makes the finite difference, not the product, wrong, so trials where halving the
+ * step changes the finite difference are skipped.
+ *
+ * It also compares the cost of axon_hvp to the cost of axon_grad.
+ *
+ * Usage: axon_check_image_encoder_hvp [trials]
+ * */
+
+#include "image_encoder.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define EPSILON 1.0e-4F
+#define TOLERANCE 1.0e-2
+#define TIMING_ITERATIONS 2000
+
+static float parameters[AXON_PARAMETERS];
+static float vector[AXON_PARAMETERS];
+static float shifted[AXON_PARAMETERS];
+static float grad_plus[AXON_PARAMETERS];
+static float grad_minus[AXON_PARAMETERS];
+static float product[AXON_PARAMETERS];
+
+/* Writes the central finite difference of the gradient along the vector, with the given step. */
+static void
+finite_difference(const float* input, const float step, double* fd)
+{
+  for (int i = 0; i < AXON_PARAMETERS; i++) {
+    shifted[i] = parameters[i] + step * vector[i];
+  }
+  axon_grad(shifted, input, grad_plus);
+
+  for (int i = 0; i < AXON_PARAMETERS; i++) {
+    shifted[i] = parameters[i] - step * vector[i];
+  }
+  axon_grad(shifted, input, grad_minus);
+
+  for (int i = 0; i < AXON_PARAMETERS; i++) {
+    fd[i] = ((double)grad_plus[i] - (double)grad_minus[i]) / (2.0 * step);
+  }
+}
+
+/* Returns the largest difference between two vectors, relative to the largest element of the product. */
+static double
+relative_error(const double* a, const double* b)
+{
+  double max_error = 0.0;
+  double max_value = 1.0e-6;
+
+  for (int i = 0; i < AXON_PARAMETERS; i++) {
+    const double error = fabs(a[i] - b[i]);
+    max_error = (error > max_error) ? error : max_error;
+    max_value = (fabs(product[i]) > max_value) ? fabs(product[i]) : max_value;
+  }
+
+  return max_error / max_value;
+}
+
+/* Returns the error of the finite difference relative to the largest element of the product, or a negative value if
+ * the finite difference is not trustworthy because halving the step changes it (the step crossed a ReLU kink). */
+static double
+check(const float* input)
+{
+  static double fd[AXON_PARAMETERS];
+  static double fd_half[AXON_PARAMETERS];
+  static double exact[AXON_PARAMETERS];
+
+  axon_hvp(parameters, input, vector, product);
+
+  for (int i = 0; i < AXON_PARAMETERS; i++) {
+    exact[i] = (double)product[i];
+  }
+
+  finite_difference(input, EPSILON, fd);
+  finite_difference(input, 0.5F * EPSILON, fd_half);
+
+  if (relative_error(fd, fd_half) > TOLERANCE) {
+    return -1.0;
+  }
+
+  return relative_error(fd, exact);
+}
+
+static double
+seconds(const clock_t start)
+{
+  return ((double)(clock() - start)) / CLOCKS_PER_SEC;
+}
+
+int
+main(int argc, char** argv)
+{
+  const int trials = (argc > 1) ? atoi(argv[1]) : 16;
+
+  axon_crng_z rng;
+  axon_crng_init(&rng, 0);
+
+  double worst = 0.0;
+  int skipped = 0;
+
+  for (int t = 0; t < trials; t++) {
+    axon_crng_z trial = axon_crng_split(&rng, (uint64_t)t);
+
+    axon_crng_float_array(&trial, parameters, AXON_PARAMETERS, 0.4F, -0.2F);
+    axon_crng_float_array(&trial, vector, AXON_PARAMETERS, 2.0F, -1.0F);
+
+    float input[AXON_HVP_INPUTS];
+    axon_crng_float_array(&trial, input, AXON_HVP_INPUTS, 1.0F, 0.0F);
+
+    const double error = check(input);
+    if (error < 0.0) {
+      skipped++;
+      continue;
+    }
+    worst = (error > worst) ? error : worst;
+  }
+
+  const float input[AXON_HVP_INPUTS] = { 0.25F, 0.75F, 0.1F, 0.5F, 0.9F };
+
+  clock_t start = clock();
+  for (int i = 0; i < TIMING_ITERATIONS; i++) {
+    axon_grad(parameters, input, grad_plus);
+  }
+  const double grad_time = seconds(start);
+
+  start = clock();
+  for (int i = 0; i < TIMING_ITERATIONS; i++) {
+    axon_hvp(parameters, input, vector, product);
+  }
+  const double hvp_time = seconds(start);
+
+  printf("worst relative error: %g (%d trials, %d skipped at a ReLU kink)\n", worst, trials - skipped, skipped);
+  printf("axon_hvp cost: %.2fx axon_grad\n", hvp_time / grad_time);
+
+  return ((worst <= TOLERANCE) && (skipped < trials)) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
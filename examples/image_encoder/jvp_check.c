@@ -0,0 +1,150 @@
+/* This program checks axon_jvp against a central finite difference of axon_eval, for random parameters, texture
+ * coordinates and tangents. The JVP outputs are the outputs of the eval module, and the differentiated inputs are both
+ * of its inputs, so:
+ *
+ *   J t ~= (eval(x + e t) - eval(x - e t)) / (2 e)
+ *
+ * The network uses ReLU activations, so trials where the step crosses a kink are skipped. Halving the step, like in
+ * hvp_check.c, misses the kinks that are closer to x than half of the step, because both differences straddle them.
+ * Those are found from the JVP itself: away from a kink it is smooth, so its value at x is about the mean of its values
+ * at x - e t and x + e t, and at a kink it jumps. The Fourier features go up to 64 pi, which the step has to be small
+ * compared to.
+ *
+ * Usage: axon_check_image_encoder_jvp [trials]
+ * */
+
+#include "image_encoder.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if (AXON_JVP_TANGENTS != AXON_EVAL_INPUTS) || (AXON_JVP_OUTPUTS != AXON_EVAL_OUTPUTS)
+#error "The JVP module is expected to differentiate every output of the eval module along every input."
+#endif
+
+#define EPSILON 1.0e-4F
+#define TOLERANCE 1.0e-2
+
+static float parameters[AXON_PARAMETERS];
+
+/* Writes the central finite difference of the outputs along the tangent, with the given step. */
+static void
+finite_difference(const float* input, const float* tangent, const float step, double* fd)
+{
+  float shifted[AXON_EVAL_INPUTS];
+  float plus[AXON_EVAL_OUTPUTS];
+  float minus[AXON_EVAL_OUTPUTS];
+
+  for (int i = 0; i < AXON_EVAL_INPUTS; i++) {
+    shifted[i] = input[i] + step * tangent[i];
+  }
+  axon_eval(parameters, shifted, plus);
+
+  for (int i = 0; i < AXON_EVAL_INPUTS; i++) {
+    shifted[i] = input[i] - step * tangent[i];
+  }
+  axon_eval(parameters, shifted, minus);
+
+  for (int i = 0; i < AXON_EVAL_OUTPUTS; i++) {
+    fd[i] = ((double)plus[i] - (double)minus[i]) / (2.0 * step);
+  }
+}
+
+/* Returns the largest difference between two vectors, relative to the largest element of the reference. */
+static double
+relative_error(const double* a, const double* b, const double* reference)
+{
+  double max_error = 0.0;
+  double max_value = 1.0e-6;
+
+  for (int i = 0; i < AXON_EVAL_OUTPUTS; i++) {
+    const double error = fabs(a[i] - b[i]);
+    max_error = (error > max_error) ? error : max_error;
+    max_value = (fabs(reference[i]) > max_value) ? fabs(reference[i]) : max_value;
+  }
+
+  return max_error / max_value;
+}
+
+/* Writes the product of the Jacobian at x + step t with the tangent. */
+static void
+shifted_jvp(const float* input, const float* tangent, const float step, double* product)
+{
+  float shifted[AXON_JVP_INPUTS];
+  float result[AXON_JVP_OUTPUTS];
+
+  for (int i = 0; i < AXON_JVP_INPUTS; i++) {
+    shifted[i] = input[i] + step * tangent[i];
+  }
+  axon_jvp(parameters, shifted, tangent, result);
+
+  for (int i = 0; i < AXON_JVP_OUTPUTS; i++) {
+    product[i] = (double)result[i];
+  }
+}
+
+/* Returns the error of the finite difference relative to the largest element of the product, or a negative value if
+ * the finite difference is not trustworthy because the step crossed a ReLU kink. */
+static double
+check(const float* input, const float* tangent)
+{
+  double fd[AXON_EVAL_OUTPUTS];
+  double fd_half[AXON_EVAL_OUTPUTS];
+  double exact[AXON_EVAL_OUTPUTS];
+  double before[AXON_EVAL_OUTPUTS];
+  double after[AXON_EVAL_OUTPUTS];
+  double mean[AXON_EVAL_OUTPUTS];
+
+  shifted_jvp(input, tangent, 0.0F, exact);
+  shifted_jvp(input, tangent, -EPSILON, before);
+  shifted_jvp(input, tangent, EPSILON, after);
+
+  for (int i = 0; i < AXON_EVAL_OUTPUTS; i++) {
+    mean[i] = 0.5 * (before[i] + after[i]);
+  }
+
+  finite_difference(input, tangent, EPSILON, fd);
+  finite_difference(input, tangent, 0.5F * EPSILON, fd_half);
+
+  if ((relative_error(fd, fd_half, exact) > TOLERANCE) || (relative_error(mean, exact, exact) > TOLERANCE)) {
+    return -1.0;
+  }
+
+  return relative_error(fd, exact, exact);
+}
+
+int
+main(int argc, char** argv)
+{
+  const int trials = (argc > 1) ? atoi(argv[1]) : 16;
+
+  axon_crng_z rng;
+  axon_crng_init(&rng, 0);
+
+  double worst = 0.0;
+  int skipped = 0;
+
+  for (int t = 0; t < trials; t++) {
+    axon_crng_z trial = axon_crng_split(&rng, (uint64_t)t);
+
+    axon_crng_float_array(&trial, parameters, AXON_PARAMETERS, 0.4F, -0.2F);
+
+    float input[AXON_JVP_INPUTS];
+    axon_crng_float_array(&trial, input, AXON_JVP_INPUTS, 1.0F, 0.0F);
+
+    float tangent[AXON_JVP_TANGENTS];
+    axon_crng_float_array(&trial, tangent, AXON_JVP_TANGENTS, 2.0F, -1.0F);
+
+    const double error = check(input, tangent);
+    if (error < 0.0) {
+      skipped++;
+      continue;
+    }
+    worst = (error > worst) ? error : worst;
+  }
+
+  printf("worst relative error: %g (%d trials, %d skipped at a ReLU kink)\n", worst, trials - skipped, skipped);
+
+  return ((worst <= TOLERANCE) && (skipped < trials)) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
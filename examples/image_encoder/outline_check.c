@@ -0,0 +1,87 @@
+/* This program checks that rerolling matrix products into loops and outlining repeated subgraphs into blocks do not
+ * change the results. It compares the functions of the library, which is generated with both, to the functions of a
+ * header that is generated with --no-reroll and --no-outline, for random parameters and samples. The passes keep the
+ * operations and their order, so the results have to be bit-identical.
+ *
+ * Usage: axon_check_image_encoder_outline [trials]
+ * */
+
+#include "image_encoder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void
+plain_eval(const float* parameters, const float* input, float* output);
+
+void
+plain_grad(const float* parameters, const float* input, float* output);
+
+void
+plain_jvp(const float* parameters, const float* input, const float* tangent, float* output);
+
+void
+plain_hvp(const float* parameters, const float* input, const float* vector, float* output);
+
+static float parameters[AXON_PARAMETERS];
+static float vector[AXON_PARAMETERS];
+static float expected[AXON_PARAMETERS];
+static float actual[AXON_PARAMETERS];
+
+/* Compares the outputs of a function, and prints the first difference. Returns the number of differences. */
+static int
+compare(const char* name, const int trial, const int count)
+{
+  for (int i = 0; i < count; i++) {
+    if (memcmp(&expected[i], &actual[i], sizeof(float)) != 0) {
+      printf("%s differs in trial %d at %d: %a (plain) vs %a\n", name, trial, i, expected[i], actual[i]);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+  const int trials = (argc > 1) ? atoi(argv[1]) : 16;
+
+  axon_crng_z rng;
+  axon_crng_init(&rng, 0);
+
+  int failures = 0;
+
+  for (int t = 0; t < trials; t++) {
+    axon_crng_z trial = axon_crng_split(&rng, (uint64_t)t);
+
+    axon_crng_float_array(&trial, parameters, AXON_PARAMETERS, 0.4F, -0.2F);
+    axon_crng_float_array(&trial, vector, AXON_PARAMETERS, 2.0F, -1.0F);
+
+    float input[AXON_GRAD_INPUTS];
+    axon_crng_float_array(&trial, input, AXON_GRAD_INPUTS, 1.0F, 0.0F);
+
+    float tangent[AXON_JVP_TANGENTS];
+    axon_crng_float_array(&trial, tangent, AXON_JVP_TANGENTS, 2.0F, -1.0F);
+
+    plain_eval(parameters, input, expected);
+    axon_eval(parameters, input, actual);
+    failures += compare("axon_eval", t, AXON_EVAL_OUTPUTS);
+
+    plain_grad(parameters, input, expected);
+    axon_grad(parameters, input, actual);
+    failures += compare("axon_grad", t, AXON_GRAD_OUTPUTS);
+
+    plain_jvp(parameters, input, tangent, expected);
+    axon_jvp(parameters, input, tangent, actual);
+    failures += compare("axon_jvp", t, AXON_JVP_OUTPUTS);
+
+    plain_hvp(parameters, input, vector, expected);
+    axon_hvp(parameters, input, vector, actual);
+    failures += compare("axon_hvp", t, AXON_PARAMETERS);
+  }
+
+  printf("%d mismatched outputs in %d trials\n", failures, trials);
+
+  return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
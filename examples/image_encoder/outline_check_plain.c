@@ -0,0 +1,30 @@
+/* This file wraps the functions of the image encoder as generated without rerolled loops and outlined blocks, so that
+ * outline_check.c can call them next to the ones from the library. It is compiled on its own, since both headers
+ * define functions with the same names.
+ * */
+
+#include "image_encoder_plain.h"
+
+void
+plain_eval(const float* parameters, const float* input, float* output)
+{
+  axon_eval(parameters, input, output);
+}
+
+void
+plain_grad(const float* parameters, const float* input, float* output)
+{
+  axon_grad(parameters, input, output);
+}
+
+void
+plain_jvp(const float* parameters, const float* input, const float* tangent, float* output)
+{
+  axon_jvp(parameters, input, tangent, output);
+}
+
+void
+plain_hvp(const float* parameters, const float* input, const float* vector, float* output)
+{
+  axon_hvp(parameters, input, vector, output);
+}
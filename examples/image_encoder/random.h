@@ -1,12 +0,0 @@
-#pragma once
-
-#ifdef __cplusplus
-extern "C"
-{
-#endif
-
-  int randint(int lo, int hi);
-
-#ifdef __cplusplus
-}
-#endif
\ No newline at end of file
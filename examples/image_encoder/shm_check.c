@@ -0,0 +1,135 @@
+/* This program trains the image encoder network with several worker processes that exchange gradients through shared
+ * memory, and then checks that every worker ended up with parameters that are bit-identical to training in a single
+ * process with the same number of shards.
+ *
+ * The training data is produced by a "teacher" network with random parameters.
+ *
+ * Usage: axon_check_image_encoder_shm [num_processes]
+ * */
+
+#define AXON_SHM
+
+#include "image_encoder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BATCH_SIZE 64
+#define BATCHES 64
+
+struct job
+{
+  float* inputs;
+};
+
+static void
+init_parameters(float* parameters)
+{
+  axon_rng_z rng;
+  axon_rng_init(&rng, 0);
+  axon_rng_float_array(&rng, parameters, AXON_PARAMETERS, 0.2F, -0.1F);
+}
+
+static int
+worker(axon_comm_z* comm, void* user)
+{
+  const struct job* job = (const struct job*)user;
+
+  float parameters[AXON_PARAMETERS];
+  init_parameters(parameters);
+
+  axon_opt_z opt;
+  axon_opt_init(&opt, 0);
+
+  for (size_t i = 0; i < BATCHES; i++) {
+    const float* batch = job->inputs + i * BATCH_SIZE * AXON_GRAD_INPUTS;
+    if (axon_comm_grad(comm, parameters, batch, BATCH_SIZE, opt.gradient) != 0) {
+      return -1;
+    }
+    axon_opt_step(&opt, 0.01F, 0.9F, parameters);
+  }
+
+  /* The gradient slots are no longer needed, so they are used to hand the results back to the launcher. */
+  memcpy(axon_comm_slot(comm, comm->rank), parameters, sizeof(parameters));
+
+  return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+  const long n = (argc > 1) ? atol(argv[1]) : 4;
+  if ((n < 1) || (n > 256)) {
+    fprintf(stderr, "invalid number of processes\n");
+    return EXIT_FAILURE;
+  }
+
+  const uint32_t num_ranks = (uint32_t)n;
+
+  struct job job;
+  job.inputs = malloc(BATCHES * BATCH_SIZE * AXON_GRAD_INPUTS * sizeof(float));
+  float* scratch = NULL;
+  if (!job.inputs || (posix_memalign((void**)&scratch, AXON_BUFFER_ALIGN, num_ranks * AXON_BUFFER_SIZE) != 0)) {
+    return EXIT_FAILURE;
+  }
+
+  float teacher[AXON_PARAMETERS];
+  axon_rng_z rng;
+  axon_rng_init(&rng, 1);
+  axon_rng_float_array(&rng, teacher, AXON_PARAMETERS, 1.0F, -0.5F);
+  for (size_t i = 0; i < (BATCHES * BATCH_SIZE); i++) {
+    float* input = job.inputs + i * AXON_GRAD_INPUTS;
+    input[0] = axon_rng_float(&rng);
+    input[1] = axon_rng_float(&rng);
+    axon_eval(teacher, input, input + AXON_EVAL_INPUTS);
+  }
+
+  /* single process reference */
+
+  float expected[AXON_PARAMETERS];
+  init_parameters(expected);
+
+  axon_opt_z opt;
+  axon_opt_init(&opt, 0);
+
+  for (size_t i = 0; i < BATCHES; i++) {
+    const float* batch = job.inputs + i * BATCH_SIZE * AXON_GRAD_INPUTS;
+    axon_grad_sharded(expected, batch, BATCH_SIZE, num_ranks, scratch, opt.gradient);
+    axon_opt_step(&opt, 0.01F, 0.9F, expected);
+  }
+
+  /* multi-process training */
+
+  char name[64];
+  snprintf(name, sizeof(name), "/axon_shm_check_%ld", (long)getpid());
+
+  axon_comm_z comm;
+  if (axon_comm_create(&comm, name, num_ranks) != 0) {
+    fprintf(stderr, "failed to create shared memory segment\n");
+    return EXIT_FAILURE;
+  }
+
+  int result = axon_comm_launch(&comm, worker, &job);
+  if (result != 0) {
+    fprintf(stderr, "a worker process failed\n");
+  }
+
+  for (uint32_t i = 0; (result == 0) && (i < num_ranks); i++) {
+    if (memcmp(axon_comm_slot(&comm, i), expected, sizeof(expected)) != 0) {
+      fprintf(stderr, "rank %u does not match the single process result\n", (unsigned)i);
+      result = -1;
+    }
+  }
+
+  axon_comm_detach(&comm);
+  shm_unlink(name);
+  free(scratch);
+  free(job.inputs);
+
+  if (result == 0) {
+    printf("%u processes: parameters are bit-identical to single process training\n", (unsigned)num_ranks);
+  }
+
+  return (result == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,13 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+
+#define AXON_THREADS
+#define AXON_PARAMS_FILE
+#define AXON_DATASET
 
 #include "image_encoder.h"
 
 #include "deps/stb_image.h"
 #include "deps/stb_image_write.h"
 
-#include "random.h"
-
 inline static uint8_t
 unpack_channel(const float x)
 {
@@ -27,23 +30,26 @@ predict(const float* parameters, const int epoch)
     return;
   }
 
-  for (int i = 0; i < (w * h); i++) {
-    const int x = i % w;
-    const int y = i / w;
+  float stage[AXON_EVAL_STAGE_SIZE];
 
-    const float u = ((float)x) / ((float)w);
+  for (int y = 0; y < h; y++) {
     const float v = ((float)y) / ((float)h);
 
-    const float input[2] = { u, v };
-    float output[3] = { 0, 0, 0 };
+    axon_eval_stage_v(parameters, &v, stage);
+
+    for (int x = 0; x < w; x++) {
+      const float u = ((float)x) / ((float)w);
+
+      float output[3] = { 0, 0, 0 };
 
-    axon_eval(parameters, input, output);
+      axon_eval_stage_u(parameters, stage, &u, output);
 
-    uint8_t* dst = &pixels[i * 3];
+      uint8_t* dst = &pixels[(y * w + x) * 3];
 
-    dst[0] = unpack_channel(output[0]);
-    dst[1] = unpack_channel(output[1]);
-    dst[2] = unpack_channel(output[2]);
+      dst[0] = unpack_channel(output[0]);
+      dst[1] = unpack_channel(output[1]);
+      dst[2] = unpack_channel(output[2]);
+    }
   }
 
   char filename[256];
@@ -52,12 +58,45 @@ predict(const float* parameters, const int epoch)
   free(pixels);
 }
 
+/* Converts the image into a dataset file, with one training record per pixel.
+ * */
+static int
+write_dataset(const char* path, const stbi_uc* pixels, const int w, const int h)
+{
+  axon_dataset_writer_z writer;
+  if (axon_dataset_create(&writer, path) != 0) {
+    return -1;
+  }
+
+  int failed = 0;
+
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      const stbi_uc* rgb = pixels + (y * w + x) * 3;
+      float record[AXON_GRAD_INPUTS];
+      record[0] = ((float)x) / ((float)w); // input
+      record[1] = ((float)y) / ((float)h);
+      record[2] = ((float)rgb[0]) / 255.0F;
+      record[3] = ((float)rgb[1]) / 255.0F;
+      record[4] = ((float)rgb[2]) / 255.0F;
+      failed = failed || axon_dataset_append(&writer, record, 1);
+    }
+  }
+
+  failed = axon_dataset_finish(&writer) || failed;
+
+  return failed ? -1 : 0;
+}
+
 int
 main()
 {
   const int epochs = 20;
   const int train_samples = 1024 * 1024;
-  const float lr = 0.01F;
+  const int batch_size = 16;
+  /* The gradient is averaged over the batch, so the learning rate is scaled with the batch size to keep the progress
+   * per sample close to that of per-sample updates with a rate of 0.01. */
+  const float lr = 0.01F * (float)batch_size;
   const float momentum = 0.9F;
   int w = 0;
   int h = 0;
@@ -67,50 +106,66 @@ main()
     return EXIT_FAILURE;
   }
 
-  axon_rng_z rng;
-  axon_rng_init(&rng, 0);
+  const int written = write_dataset("sample.dataset", pixels, w, h);
+
+  stbi_image_free(pixels);
+
+  axon_dataset_z dataset;
+  if ((written != 0) || (axon_dataset_map(&dataset, "sample.dataset") != 0)) {
+    fprintf(stderr, "failed to create dataset\n");
+    return EXIT_FAILURE;
+  }
+
+  axon_crng_z rng;
+  axon_crng_init(&rng, 0);
 
   axon_opt_z opt;
   axon_opt_init(&opt, 0);
 
   float parameters[AXON_PARAMETERS];
-  axon_rng_float_array(&rng, parameters, AXON_PARAMETERS, 0.2F, -0.1F);
-
-  float input[AXON_GRAD_INPUTS];
+  axon_crng_float_array(&rng, parameters, AXON_PARAMETERS, 0.2F, -0.1F);
 
-  for (int epoch = 0; epoch < epochs; epoch++) {
+  axon_pool_z pool;
+  if (axon_pool_init(&pool, (size_t)sysconf(_SC_NPROCESSORS_ONLN)) != 0) {
+    fprintf(stderr, "failed to create thread pool\n");
+    return EXIT_FAILURE;
+  }
 
-    for (int i = 0; i < train_samples; i++) {
+  axon_sampler_z sampler;
+  if (axon_sampler_init(&sampler, &dataset, batch_size, 0) != 0) {
+    fprintf(stderr, "failed to create sampler\n");
+    return EXIT_FAILURE;
+  }
 
-      // const uint32_t x = axon_rng_range(&rng, 0, (uint32_t)w - 1);
-      // const uint32_t y = axon_rng_range(&rng, 0, (uint32_t)h - 1);
-      const int x = randint(0, w - 1);
-      const int y = randint(0, h - 1);
+  for (int epoch = 0; epoch < epochs; epoch++) {
 
-      const float u = ((float)x) / ((float)w);
-      const float v = ((float)y) / ((float)h);
+    for (int i = 0; i < train_samples;) {
 
-      const uint32_t j = (y * ((uint32_t)w) + x) * 3;
+      const float* batch = NULL;
 
-      const stbi_uc* rgb = pixels + j;
+      const size_t count = axon_sampler_next(&sampler, &dataset, &batch);
 
-      input[0] = u; // input
-      input[1] = v;
-      input[2] = ((float)rgb[0]) / 255.0F;
-      input[3] = ((float)rgb[1]) / 255.0F;
-      input[4] = ((float)rgb[2]) / 255.0F;
+      i += (int)count;
 
-      axon_grad(parameters, input, opt.gradient);
+      axon_pool_grad(&pool, parameters, batch, count, opt.gradient);
 
       axon_opt_step(&opt, lr, momentum, parameters);
     }
 
     predict(parameters, epoch);
 
+    if (axon_params_save(AXON_PARAMETERS_PATH, parameters, &opt) != 0) {
+      fprintf(stderr, "failed to save parameters\n");
+    }
+
     printf("epoch[%d]\n", epoch);
   }
 
-  stbi_image_free(pixels);
+  axon_sampler_destroy(&sampler);
+
+  axon_pool_destroy(&pool);
+
+  axon_dataset_unmap(&dataset);
 
   return EXIT_SUCCESS;
 }